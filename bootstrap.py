@@ -52,6 +52,9 @@ if args.ci:
 else:
     ldflags.extend(['-llua'])
 
+# ThreadPool runs on std::thread.
+ldflags.append('-pthread')
+
 def warning(string):
     print('warning: {}'.format(string))
 
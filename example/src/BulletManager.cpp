@@ -1,5 +1,6 @@
 #include "BulletManager.hpp"
-#include <bulletlua/BulletLua.hpp>
+
+#include <cmath>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -44,47 +45,40 @@ BulletManager::BulletManager(int left, int top, int width, int height,
     // Generate vertex buffer object buffer.
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    setSnapshots(true);
 }
 
 BulletManager::~BulletManager()
 {
 }
 
-void BulletManager::tick()
+void BulletManager::upload()
 {
-    collision.reset();
-
-    unsigned int i = 0;
-    for (auto iter = bullets.begin(); iter != bullets.end();)
-    {
-        // Must be set so lua knows which bullet to modify.
-        current = *iter;
-
-        (*iter)->run(collision);
+    SnapshotBuffer& buffer = snapshots();
+    if (!buffer.update())
+        return;
 
-        // If the current bullet is dead, push it onto the free stack.
-        // Keep in mind `erase` increments our iterator and returns a valid iterator.
-        if ((*iter)->isDead())
-        {
-            freeBullets.push(*iter);
-            iter = bullets.erase(iter);
-            continue;
-        }
+    const Snapshot& bullets = buffer.front();
 
-        // Our vertex arrays are not dynamic (for now), so we gotta cap the number of entries.
-        if (i > MAX_BULLETS)
-            continue;
+    // Our vertex arrays are not dynamic (for now), so we gotta cap the number of entries.
+    unsigned int count = bullets.size() < MAX_BULLETS ? bullets.size() : MAX_BULLETS;
 
-        const Bullet* b = *iter;
+    unsigned int i = 0;
+    for (; i < count; ++i)
+    {
         float rad = std::sqrt(8*8 + 8*8);
-        float dir = b->getDirection();
+        float dir = bullets.direction[i];
+
+        float cx = bullets.x[i] + bullets.w[i] / 2;
+        float cy = bullets.y[i] + bullets.h[i] / 2;
 
         // Unrolled loops!
 
-        float red   = b->r / 256.0f;
-        float green = b->g / 256.0f;
-        float blue  = b->b / 256.0f;
-        float alpha = b->life / 256.0f;
+        float red   = bullets.r[i] / 256.0f;
+        float green = bullets.g[i] / 256.0f;
+        float blue  = bullets.b[i] / 256.0f;
+        float alpha = bullets.life[i] / 256.0f;
 
         colorArray[i * 16 + 0]  = red;
         colorArray[i * 16 + 1]  = green;
@@ -119,25 +113,17 @@ void BulletManager::tick()
         textureArray[i * 8 + 7] = 1.0f;
 
         // Rotate coordinates around center
-        vertexArray[i * 8 + 0] = b->position.getCenterX() +  rad * (float)sin(dir - 3.1415f/4);
-        vertexArray[i * 8 + 1] = b->position.getCenterY() + -rad * (float)cos(dir - 3.1415f/4);
-
-        vertexArray[i * 8 + 2] = b->position.getCenterX() +  rad * (float)sin(dir + 3.1415f/4);
-        vertexArray[i * 8 + 3] = b->position.getCenterY() + -rad * (float)cos(dir + 3.1415f/4);
+        vertexArray[i * 8 + 0] = cx +  rad * (float)sin(dir - 3.1415f/4);
+        vertexArray[i * 8 + 1] = cy + -rad * (float)cos(dir - 3.1415f/4);
 
-        vertexArray[i * 8 + 4] = b->position.getCenterX() +  rad * (float)sin(dir + 3 * 3.1415f/4);
-        vertexArray[i * 8 + 5] = b->position.getCenterY() + -rad * (float)cos(dir + 3 * 3.1415f/4);
+        vertexArray[i * 8 + 2] = cx +  rad * (float)sin(dir + 3.1415f/4);
+        vertexArray[i * 8 + 3] = cy + -rad * (float)cos(dir + 3.1415f/4);
 
-        vertexArray[i * 8 + 6] = b->position.getCenterX() +  rad * (float)sin(dir + 5 * 3.1415f/4);
-        vertexArray[i * 8 + 7] = b->position.getCenterY() + -rad * (float)cos(dir + 5 * 3.1415f/4);
+        vertexArray[i * 8 + 4] = cx +  rad * (float)sin(dir + 3 * 3.1415f/4);
+        vertexArray[i * 8 + 5] = cy + -rad * (float)cos(dir + 3 * 3.1415f/4);
 
-        if ((*iter)->collisionCheck)
-        {
-            collision.addBullet(*iter);
-        }
-
-        ++i;
-        ++iter;
+        vertexArray[i * 8 + 6] = cx +  rad * (float)sin(dir + 5 * 3.1415f/4);
+        vertexArray[i * 8 + 7] = cy + -rad * (float)cos(dir + 5 * 3.1415f/4);
     }
 
     bulletCount = i;
@@ -191,14 +177,16 @@ void BulletManager::draw() const
 
 void BulletManager::drawCollision() const
 {
-    for (auto iter = bullets.begin(); iter != bullets.end(); ++iter)
+    const Snapshot& bullets = snapshotBuffer.front();
+
+    for (unsigned int i = 0; i < bullets.size(); ++i)
     {
-        if (!(*iter)->isDying())
+        if (!(bullets.flags[i] & BulletStore::Dying))
         {
-            float x = (*iter)->position.x;
-            float y = (*iter)->position.y;
-            float w = (*iter)->position.w;
-            float h = (*iter)->position.h;
+            float x = bullets.x[i];
+            float y = bullets.y[i];
+            float w = bullets.w[i];
+            float h = bullets.h[i];
 
             glColor4f(1.0f, 0.0f, 0.0f, 1.0f);
             glBegin(GL_QUADS);
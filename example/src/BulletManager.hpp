@@ -11,10 +11,13 @@ class BulletManager : public BulletLuaManager
                       const BulletLuaUtils::Rect& player);
         ~BulletManager() final;
 
-        void tick() final;
+        // Build and upload vertices from the latest snapshot the manager published, if there is
+        // a new one. Doesn't touch the simulation, so it could run on a render thread.
+        void upload();
         void draw() const;
 
-        // View collision box for bullets (debug). Uses OpenGL immediate mode.
+        // View collision box for bullets (debug), as of the last upload(). Uses OpenGL immediate
+        // mode.
         void drawCollision() const;
 
         unsigned int getVertexCount() const;
@@ -181,6 +181,7 @@ int main(int argc, char *argv[])
         }
         glEnd();
 
+        manager.upload();
         manager.draw();
 
         if (collision)
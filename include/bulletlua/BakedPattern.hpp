@@ -0,0 +1,119 @@
+#ifndef _BakedPattern_hpp_
+#define _BakedPattern_hpp_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <bulletlua/BulletStore.hpp>
+
+// A pattern recorded from a live run, to be replayed without running any lua.
+//
+// Each bullet is a track: the frame it appeared on, the frame it was removed on, and keyframes
+// of its state. Between keyframes a bullet just flies at its keyframed velocity, so a new
+// keyframe is only stored when a script (or behavior) changed something. Replays are exact for
+// patterns that only depend on the frame they were started on; anything aiming at the player
+// or using random numbers will replay the recorded run, not a new one.
+class BakedPattern
+{
+    public:
+        // State of a bullet from `frame` on, as it was after BulletStore::step.
+        struct Key
+        {
+            unsigned int frame;
+            float x, y;
+            float vx, vy;
+            float w, h;
+            float radius;
+
+            // BulletStore::Collision and BulletStore::Dying.
+            unsigned char flags;
+            unsigned char life;
+            unsigned char layer;
+            unsigned char r, g, b;
+        };
+
+        struct Track
+        {
+            unsigned int spawn;
+
+            // Frame the bullet was removed on, or FOREVER if it outlived the recording (it then
+            // keeps flying at its last velocity).
+            unsigned int end;
+
+            // Range of `keys`. The first key is on the spawn frame.
+            unsigned int firstKey;
+            unsigned int keyCount;
+        };
+
+        static const unsigned int FOREVER = 0xFFFFFFFF;
+
+        // Number of frames recorded.
+        unsigned int frames;
+
+        // Sorted by spawn frame.
+        std::vector<Track> tracks;
+        std::vector<Key> keys;
+
+        BakedPattern();
+
+        // Binary asset in native byte order. Returns false on I/O errors or a bad file. Counts,
+        // key ranges and the order of spawns and keys are checked, so a corrupt file is rejected
+        // rather than loaded.
+        bool save(const std::string& filename) const;
+        bool load(const std::string& filename);
+};
+
+// Builds a BakedPattern from the state of a store after every tick.
+class PatternRecorder
+{
+    public:
+        PatternRecorder();
+
+        void capture(const BulletStore& bullets);
+        BakedPattern finish();
+
+    private:
+        // Where an unchanged bullet would be now; positions advance exactly like in step().
+        struct Open
+        {
+            unsigned int track;
+            float x, y;
+            bool seen;
+        };
+
+        unsigned int frame;
+        std::vector<BakedPattern::Track> tracks;
+        std::vector<std::vector<BakedPattern::Key>> trackKeys;
+        std::unordered_map<BulletStore::Handle, Open> open;
+};
+
+// Replays a BakedPattern into a store, one frame per advance().
+class PatternPlayer
+{
+    public:
+        explicit PatternPlayer(std::shared_ptr<const BakedPattern> pattern);
+
+        // Play the next frame. Call after BulletStore::step and before removeDead. New bullets
+        // come from `spawn`, which must add one to `bullets` and return its index.
+        void advance(BulletStore& bullets, const std::function<unsigned int()>& spawn);
+
+        bool finished() const;
+
+    private:
+        struct Live
+        {
+            BulletStore::Handle handle;
+            unsigned int track;
+            unsigned int nextKey;
+        };
+
+        std::shared_ptr<const BakedPattern> pattern;
+        unsigned int frame;
+        unsigned int nextTrack;
+        std::vector<Live> live;
+};
+
+#endif // _BakedPattern_hpp_
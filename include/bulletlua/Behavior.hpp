@@ -0,0 +1,66 @@
+#ifndef _Behavior_hpp_
+#define _Behavior_hpp_
+
+#include <cstddef>
+
+class BulletStore;
+
+// Parametric motion the manager evaluates natively every frame, for bullets that would otherwise
+// run a lua function just to turn, speed up, sway or fade out.
+//
+// Behaviors are shared: the manager keeps one copy of each distinct behavior in use and bullets
+// refer to it by id (BulletStore::behavior). Every part is optional; a default-constructed behavior
+// does nothing. Angles are in radians, clockwise, per frame.
+struct Behavior
+{
+    // Turn by this much every frame.
+    float turn;
+
+    // Change speed by this much every frame, then clamp it to [minSpeed, maxSpeed].
+    float accel;
+    float minSpeed;
+    float maxSpeed;
+
+    // Vanish on this turn. 0 means never.
+    unsigned int life;
+
+    // Turn towards the nearest target by at most this much every frame. 0 is off.
+    float homing;
+
+    // Sway around the flight direction by up to `amplitude`, once every `period` frames.
+    // A period of 0 is off.
+    float amplitude;
+    float period;
+
+    // Circle around (orbitX, orbitY) at this rate. Replaces the bullet's own velocity.
+    // 0 is off.
+    float orbit;
+    float orbitX;
+    float orbitY;
+
+    Behavior();
+
+    // Compare parameters (not the precomputed values below).
+    bool operator==(const Behavior& other) const;
+
+    // Hashes parameters, so behaviors that compare equal hash alike.
+    struct Hash
+    {
+        std::size_t operator()(const Behavior& behavior) const;
+    };
+
+    // Update the precomputed values after changing parameters.
+    void prepare();
+
+    // Move the `count` bullets in `indices` one frame along, one part of the behavior at a time
+    // over all of them. (tx[k], ty[k]) is the center of the nearest target of bullet k, only read
+    // for homing.
+    void apply(BulletStore& bullets, const unsigned int* indices, unsigned int count,
+               const float* tx, const float* ty) const;
+
+    private:
+        float turnCos, turnSin;
+        float orbitCos, orbitSin;
+};
+
+#endif // _Behavior_hpp_
@@ -51,11 +51,6 @@ class Bullet
         void setColor(unsigned char newR, unsigned char newG, unsigned char newB);
 
         void update();
-
-    private:
-        // Adjust speed if near zero as setDirection depends on at least one component
-        // of our velocity vector is non-zero.
-        void fixSpeed();
 };
 
 #endif // _Bullet_hpp_
@@ -0,0 +1,30 @@
+#ifndef _BulletLuaApi_hpp_
+#define _BulletLuaApi_hpp_
+
+#include <bulletlua/BulletStore.hpp>
+
+struct lua_State;
+class BulletLuaManager;
+
+// The functions BulletLua scripts can call.
+//
+// Every function works two ways. Called as a method on a bullet object (`b:setSpeed(2)`), it
+// acts on that bullet. Called as a plain global (`setSpeed(2)`), it acts on the bullet whose
+// script is currently running, for scripts written before bullets were passed explicitly.
+//
+// Bullet objects are light userdata holding a BulletStore::Handle, so passing one to a script
+// allocates nothing, and methods on a bullet that has since died do nothing.
+class BulletLuaApi
+{
+    public:
+        // Install the API into `L` as methods of bullet objects, and as a fallback for globals.
+        static void open(lua_State* L, BulletLuaManager* manager);
+
+        // Push the object for bullet `handle`.
+        static void pushBullet(lua_State* L, BulletStore::Handle handle);
+
+    private:
+        struct Functions;
+};
+
+#endif // _BulletLuaApi_hpp_
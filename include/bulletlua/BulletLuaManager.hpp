@@ -1,16 +1,26 @@
 #ifndef _BulletLuaManager_hpp_
 #define _BulletLuaManager_hpp_
 
-#include <list>
-#include <stack>
-
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <sol.hpp>
 
 // #include <bulletlua/BulletModel.hpp>
+#include <bulletlua/BakedPattern.hpp>
+#include <bulletlua/Behavior.hpp>
+#include <bulletlua/BulletStore.hpp>
+#include <bulletlua/LuaStatePool.hpp>
+#include <bulletlua/ScriptTable.hpp>
+#include <bulletlua/Snapshot.hpp>
 #include <bulletlua/SpacialPartition.hpp>
+#include <bulletlua/ThreadPool.hpp>
+#include <bulletlua/TimingWheel.hpp>
 #include <bulletlua/Utils/Rng.hpp>
 #include <bulletlua/Utils/Rect.hpp>
 
@@ -21,30 +31,161 @@ namespace
 }
 
 class Bullet;
-class BulletLua;
 
 class BulletLuaManager
 {
+    friend class BulletLuaApi;
+
+    public:
+        // When bullets fired by scripts run their own script for the first time: later in the
+        // frame they were fired on, or on the next frame. Either way they are added once the
+        // scripts running at the time are done, and move on the frame they were fired.
+        enum SpawnTiming
+        {
+            SAME_FRAME,
+            NEXT_FRAME
+        };
+
     protected:
-        // Pointer to the bullet that is to-be-processed.
-        BulletLua* current;
+        // One fire call: `count` bullets centered on (x, y) on `layer`, bullet k moving in
+        // direction d + k * dStep (radians) at speed s + k * sStep. They run `function` of
+        // `state`, or only `behavior` if there is no function.
+        struct Spawn
+        {
+            float x;
+            float y;
+            float d;
+            float dStep;
+            float s;
+            float sStep;
+            unsigned int count;
+            ScriptTable::Id state;
+            ScriptTable::Id function;
+            unsigned short behavior;
+            unsigned char layer;
+
+            // Hitbox and color of the new bullets.
+            float w;
+            float h;
+            float radius;
+            unsigned char r;
+            unsigned char g;
+            unsigned char b;
+        };
+
+        // Everything the scripts of one group change outside their own bullets while groups run
+        // in parallel. Applied in group order once they are all done, so the outcome doesn't
+        // depend on thread timing.
+        struct Lane
+        {
+            unsigned int current;
+
+            // Each spawn holds its function until it is applied.
+            std::vector<Spawn> spawns;
+
+            // Users the group's scripts added to and dropped from functions. Scripts of other
+            // groups can't use these functions, so applying them later changes nothing for them.
+            std::vector<std::pair<ScriptTable::Id, unsigned int>> retained;
+            std::vector<std::pair<ScriptTable::Id, unsigned int>> released;
+
+            std::vector<BulletStore::Handle> next;
+            std::vector<std::pair<BulletStore::Handle, unsigned int>> sleeping;
+
+            // Seeded from the manager's generator before every round.
+            BulletLuaUtils::LCRandom rng;
+        };
+
+        // The lane of the script running on this thread, or nullptr outside a parallel script
+        // phase.
+        static thread_local Lane* lane;
+
+        // Index of the bullet whose script is running. Scripts that call the API as globals
+        // instead of as methods on their bullet act on this one.
+        unsigned int current;
 
         // Collision object that bullets can "aim" at (i.e. the player).
         const BulletLuaUtils::Rect& player;
 
+        // Something bullets on layer `hitBy` can collide with. The player is always target 0.
+        struct Target
+        {
+            const BulletLuaUtils::Rect* rect;
+            CollisionLayer hitBy;
+        };
+
+        std::vector<Target> targets;
+
         // Rank [0.0, 1.0] represents the requested difficulty of a bullet pattern.
         float rank;
 
-        std::list<BulletLua*> bullets;
-        std::stack<BulletLua*> freeBullets;
+        // Number of finished ticks. Bullets parked by wait() sleep until a given frame.
+        unsigned int frame;
+
+        SpawnTiming timing;
+
+        // Fire calls of serial scripts, applied in order once the running round is over. Each
+        // holds its function until then.
+        std::vector<Spawn> spawns;
+
+        // Runs groups of scripts in parallel if set. Not owned.
+        ThreadPool* pool;
 
-        std::list<BulletLua*> blocks;
+        // Bullets of the active list grouped by lua state, one lane per group, and the group of
+        // each state id (or NO_GROUP).
+        std::vector<std::vector<BulletStore::Handle>> groups;
+        std::vector<Lane> lanes;
+        std::vector<unsigned int> groupOf;
+
+        // Guards the behavior table, which scripts of any group may add to and release from.
+        std::mutex behaviorLock;
+
+        // Bullets whose scripts run this frame and next frame. Sleeping bullets wait in
+        // `sleepers` instead, and stopped ones are in neither.
+        std::vector<BulletStore::Handle> active;
+        std::vector<BulletStore::Handle> next;
+        TimingWheel sleepers;
+
+        // Lua states for root bullets, and the states and functions live bullets use. Declared
+        // before `bullets` so they outlive their scripts.
+        LuaStatePool states;
+        ScriptTable scriptTable;
+
+        // Live bullets, stored as parallel arrays.
+        BulletStore bullets;
+
+        // Distinct native behaviors bullets use, indexed by BulletStore::behavior, and how many
+        // bullets (including ones of pending spawns) use each. Entry 0 is "none". Ids nothing uses
+        // are reused.
+        std::vector<Behavior> behaviors;
+        std::vector<unsigned int> behaviorUsers;
+        std::vector<unsigned short> freeBehaviors;
+        std::unordered_map<Behavior, unsigned short, Behavior::Hash> behaviorIds;
+
+        // Live bullets with a behavior, grouped by behavior id: those of id n are
+        // behaviorOrder[behaviorEnd[n - 1], behaviorEnd[n]). Rebuilt every frame.
+        std::vector<unsigned int> behaviorEnd;
+        std::vector<unsigned int> behaviorOrder;
+
+        // Nearest target centers of a batch of homing bullets.
+        std::vector<float> targetX;
+        std::vector<float> targetY;
+
+        // Baked patterns being replayed.
+        std::vector<PatternPlayer> playbacks;
+
+        // Number of BLOCK_SIZE blocks the store has room for.
+        unsigned int blocks;
 
         // std::vector<BulletModel> models;
 
-        SpacialPartition collision;
+        // One collision grid per layer, indexed by CollisionLayer.
+        std::vector<std::unique_ptr<SpacialPartition>> layers;
         BulletLuaUtils::MTRandom rng;
 
+        // Where tick() publishes its snapshots, if `publishing`.
+        SnapshotBuffer snapshotBuffer;
+        bool publishing;
+
     public:
         BulletLuaManager(int left, int top, int width, int height, const BulletLuaUtils::Rect& playerp);
         virtual ~BulletLuaManager();
@@ -57,42 +198,197 @@ class BulletLuaManager
         // void registerModel(const BulletModel& model);
         // const BulletModel& getModel(int index) const;
 
-        // Create a root bullet from an external script.
-        void createBulletFromFile(const std::string& filename,
+        // Create a root bullet from an external script. Compiled scripts are cached (see
+        // ChunkCache), so launching the same file again doesn't re-parse it.
+        BulletStore::Handle createBulletFromFile(const std::string& filename,
                                   Bullet* origin);
 
         // Create a root bullet from an embedded script.
-        void createBulletFromScript(const std::string& script,
+        BulletStore::Handle createBulletFromScript(const std::string& script,
                                     Bullet* origin);
 
-        // Create child bullet
-        void createBullet(std::shared_ptr<sol::state> lua,
+        // Create child bullet. Returns its index.
+        unsigned int createBullet(std::shared_ptr<sol::state> lua,
                           const sol::function& func,
                           float x, float y, float d, float s);
 
         bool checkCollision();
+
+        // Test a circular hitbox instead of the player rect.
+        bool checkCollision(float cx, float cy, float radius);
+
+        // Hits, grazes and the nearest bullet around the player in one pass. Up to `capacity`
+        // handles of bullets hitting the player are written to `hits`.
+        CollisionResult queryCollision(float grazeRadius,
+                                       BulletStore::Handle* hits=nullptr, unsigned int capacity=0);
+
+        // Register another collision target (a co-op player, an enemy, ...) that bullets on layer
+        // `hitBy` can hit. The rect must outlive the manager or be removed with clearTargets().
+        // Returns the target's index.
+        unsigned int addTarget(const BulletLuaUtils::Rect& target,
+                               CollisionLayer hitBy=ENEMY_BULLETS);
+
+        // Remove every target except the player.
+        void clearTargets();
+        unsigned int targetCount() const;
+
+        // Test every target against its layer in one batch. results[i] is for target i.
+        void checkCollisions(bool* results) const;
+        void queryCollisions(float grazeRadius, CollisionResult* results) const;
+
+        // Test bullets that move further than their hitbox size per tick along their whole path,
+        // so they can't tunnel through the player. Off by default.
+        void setSweptCollision(bool enabled);
+
+        // Run the scripts of different lua states (i.e. of different root bullets) in parallel
+        // on `pool`, or on this thread if it is null. The pool must outlive its use here. It may
+        // be shared with other managers and hosts, which then take turns, but not with the one
+        // whose jobs run this manager's tick(): run() throws std::logic_error then.
+        //
+        // Bullets fired in parallel are added once every group is done, in a fixed order, and
+        // then run their first frame in another round. Scripts draw random numbers from a
+        // generator of their group's own. So a parallel tick doesn't depend on the number of
+        // threads, but it does differ from a serial one in spawn order and random numbers.
+        // Collision grids are built on the pool too, with the same result as a serial build.
+        void setThreadPool(ThreadPool* pool);
+
+        // SAME_FRAME by default.
+        void setSpawnTiming(SpawnTiming timing);
+
+        // Restart the generator scripts draw random numbers from, so a run can be repeated. It is
+        // seeded randomly otherwise.
+        void seed(std::uint_fast64_t value);
+
         virtual void tick();
 
+        // Publish a Snapshot of every bullet at the end of each tick. A render or network thread
+        // can read them from snapshots() while the next tick runs, instead of overriding tick().
+        // Off by default.
+        void setSnapshots(bool enabled);
+
+        // Only one thread may read from the buffer (see SnapshotBuffer).
+        SnapshotBuffer& snapshots();
+
+        // Starts a pattern in the given manager, e.g. by calling createBulletFromFile.
+        typedef std::function<void(BulletLuaManager&)> Launcher;
+
+        // Run a pattern headless (in a manager of its own with the same area, player and rank)
+        // for `frames` frames and record it.
+        BakedPattern bake(const Launcher& launch, unsigned int frames);
+
+        // Replay a baked pattern from this frame on, with no lua involved. Replayed bullets are
+        // ordinary bullets as far as collision and drawing are concerned.
+        void play(std::shared_ptr<const BakedPattern> pattern);
+        unsigned int playingCount() const;
+
+        // Run the pattern live and its replay side by side. Returns the first frame on which
+        // their bullets differ by more than `tolerance`, or -1 if they match throughout.
+        int verifyBake(const Launcher& launch, std::shared_ptr<const BakedPattern> pattern,
+                       float tolerance=0.01f);
+
         // Draw function.
         // void draw()
 
-        // Move all bullets to the free stack
+        // Remove all bullets.
         void clear();
         void vanishAll();
 
+        // Handle-based access for game code. Stale handles are ignored.
+        bool isAlive(BulletStore::Handle handle) const;
+        void vanish(BulletStore::Handle handle);
+        void kill(BulletStore::Handle handle);
+
+        // Initialize lua states for `count` root bullets ahead of time (e.g. at stage start).
+        void prewarmStates(unsigned int count);
+        unsigned int idleStateCount() const;
+
         unsigned int bulletCount() const;
         unsigned int freeCount() const;
         unsigned int blockCount() const;
 
     protected:
-        // Returns an unused bullet. Allocates more data blocks if there none are available
-        BulletLua* getFreeBullet();
+        // Appends an unused bullet and returns its index.
+        // Allocates more data blocks if there none are available.
+        unsigned int getFreeBullet();
 
         // Allocate a new block of Bullet data.
         virtual void increaseCapacity(unsigned int blockSize=BLOCK_SIZE);
 
-        // Create a BulletLua lua state with the necessary functions.
-        std::shared_ptr<sol::state> initLua();
+        // Make room for more than `count` more bullets, in one allocation.
+        void reserveFree(unsigned int count);
+
+        // Give bullet `i` a script and queue it to run this frame.
+        void start(unsigned int i, ScriptTable::Id state, ScriptTable::Id function);
+
+        // Spawn a root bullet at `origin` running the main function of `luaState`.
+        BulletStore::Handle startRoot(std::shared_ptr<sol::state> luaState, Bullet* origin);
+
+        // Drop bullet `i`'s hold on its lua state, function and coroutine. Call before removing
+        // it.
+        void releaseScript(unsigned int i);
+
+        // Remove dead bullets from the store, releasing their scripts.
+        void removeDead();
+
+        // Queue bullet `i` to run its script from the next frame on, if it was stopped.
+        void wakeUp(unsigned int i);
+
+        // Index of the bullet whose script is running on this thread.
+        unsigned int running() const;
+
+        // Queue a spawn for the end of the running round.
+        void fire(const Spawn& spawn);
+
+        // Add or drop users of a function. Changes made by parallel scripts wait in their lane
+        // until the round is merged.
+        void retainFunction(ScriptTable::Id function, unsigned int n=1);
+        void releaseFunction(ScriptTable::Id function, unsigned int n=1);
+
+        // Apply and empty a buffer of spawns.
+        void commit(std::vector<Spawn>& buffer);
+
+        // Random numbers for scripts, from the running lane's generator if there is one.
+        float randomFloat(float low, float high);
+        long long randomInt(long long low, long long high);
+
+        // Run (or resume) the script of the bullet `handle` refers to and schedule its next run.
+        void runScript(BulletStore::Handle handle);
+
+        // Run the active scripts round after round, until bullets fired in one round have run
+        // their first frame too (with SAME_FRAME timing).
+        void runScripts();
+
+        // Run active[begin, end) grouped by lua state on the pool.
+        void runRound(unsigned int begin, unsigned int end);
+        void runGroup(unsigned int g);
+
+        // Apply the lanes of the first `count` groups in order and empty the groups.
+        void mergeRound(unsigned int count);
+
+        // Id of `behavior` in the behavior table, adding it if it's new, with `users` more users.
+        // Returns 0 if the table is full.
+        unsigned short internBehavior(const Behavior& behavior, unsigned int users);
+        void releaseBehavior(unsigned short id, unsigned int n=1);
+
+        // Move every bullet with a behavior one frame along, one batch of loops per behavior.
+        void runBehaviors();
+
+        // Spawn a batch of bullets. Room for the whole batch is reserved at once and they share
+        // one function. Returns the index of the first; the others follow it.
+        unsigned int fireBatch(const Spawn& spawn);
+
+        // Closest target bullet `i` can hit, or the player if there is none.
+        const BulletLuaUtils::Rect& nearestTarget(unsigned int i) const;
+
+        // Run (or resume) the script of bullet `i`, unless it is waiting. Movement happens
+        // afterwards, in BulletStore::step.
+        void run(unsigned int i);
+
+        // Run the chunk a ChunkCache load call left on the stack, or raise its error.
+        void runChunk(sol::state& luaState, int loadStatus);
+
+        // Load the libraries and functions BulletLua scripts use into a new lua state.
+        void initLua(sol::state& luaState);
 };
 
 #endif /* _BulletLuaManager_hpp_ */
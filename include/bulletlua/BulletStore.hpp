@@ -0,0 +1,195 @@
+#ifndef _BulletStore_hpp_
+#define _BulletStore_hpp_
+
+#include <vector>
+#include <cstdint>
+
+#include <sol.hpp>
+
+#include <bulletlua/Utils/Rect.hpp>
+
+class Bullet;
+
+// Bullets on different layers never collide with each other's targets. Children inherit their
+// parent's layer.
+enum CollisionLayer : unsigned char
+{
+    ENEMY_BULLETS  = 0,
+    PLAYER_BULLETS = 1,
+    HAZARDS        = 2,
+
+    LAYER_COUNT
+};
+
+// Structure-of-arrays bullet storage.
+// Every per-frame pass (movement, culling, collision, rendering) only needs a handful of
+// fields, so each field lives in its own contiguous array and the passes stream over them
+// linearly. Lua handles are only touched when a script runs, so they sit in a side table.
+//
+// Live bullets always occupy indices [0, size()). Removing a bullet moves the last bullet
+// into its slot, so indices are only stable until the next removal. Code that needs to refer
+// to a bullet across ticks should hold a Handle instead: a 22-bit slot number plus a 10-bit
+// generation that is bumped whenever the slot is freed, so stale handles simply stop resolving.
+// Slots are recycled forever and the generation wraps, so a handle kept while its slot is
+// reused 1024 times can resolve to a newer bullet.
+class BulletStore
+{
+    public:
+        typedef std::uint32_t Handle;
+
+        static const Handle INVALID_HANDLE = 0xFFFFFFFF;
+        static const unsigned int INVALID_INDEX = 0xFFFFFFFF;
+
+        // Hitbox size of new bullets.
+        static constexpr float DEFAULT_SIZE = 4.0f;
+
+        enum Flag : unsigned char
+        {
+            Dead      = 1 << 0,
+            Dying     = 1 << 1,
+            Collision = 1 << 2
+        };
+
+        // Cold data: the lua state a bullet belongs to and the function it runs, as ids into the
+        // manager's ScriptTable (0 for none). Children share their parent's state.
+        struct Script
+        {
+            unsigned int state;
+            unsigned int function;
+
+            // Coroutine of a bullet parked by wait(), or nullptr. `coroutine` is the registry
+            // reference that keeps it alive.
+            lua_State* thread;
+            int coroutine;
+
+            // Manager frame the bullet's script runs again on, or NEVER once it has stopped.
+            unsigned int wake;
+
+            // Whether the bullet is in one of the manager's dispatch lists (or its timing wheel).
+            bool queued;
+
+            static const unsigned int NEVER = 0xFFFFFFFF;
+        };
+
+        // Top-left corner and size of the collision box.
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> w;
+        std::vector<float> h;
+
+        // Circle hitbox radius, centered in the collision box. Zero means the box is the hitbox.
+        std::vector<float> radius;
+
+        std::vector<float> vx;
+        std::vector<float> vy;
+
+        std::vector<int> life;
+        std::vector<int> turn;
+        std::vector<unsigned char> flags;
+        std::vector<unsigned char> layer;
+
+        // Native behavior the manager applies every frame (an index into its behavior table), or
+        // 0 for none.
+        std::vector<unsigned short> behavior;
+
+        std::vector<unsigned char> r;
+        std::vector<unsigned char> g;
+        std::vector<unsigned char> b;
+
+        std::vector<Script> scripts;
+
+        // Handle of each live bullet.
+        std::vector<Handle> handles;
+
+    private:
+        static const unsigned int SLOT_BITS = 22;
+        static const std::uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1;
+        static const std::uint32_t GENERATION_MASK = (1u << (32 - SLOT_BITS)) - 1;
+
+        // Indexed by slot: where the bullet currently lives and which generation owns the slot.
+        std::vector<std::uint32_t> slotIndex;
+        std::vector<std::uint32_t> slotGeneration;
+
+        // Free slots, reused oldest first so a slot's generation only wraps after every other
+        // free slot has been reused too. A ring as long as there are slots, starting at
+        // freeSlots[freeHead].
+        std::vector<std::uint32_t> freeSlots;
+        unsigned int freeHead;
+        unsigned int freeCount;
+
+    public:
+        BulletStore();
+
+        BulletStore(const BulletStore&) = delete;
+        BulletStore& operator=(const BulletStore&) = delete;
+
+        unsigned int size() const;
+        unsigned int capacity() const;
+        bool empty() const;
+
+        // Make sure `n` bullets fit without reallocating any array.
+        void reserve(unsigned int n);
+
+        // Returns INVALID_INDEX if the handle's bullet has been removed.
+        unsigned int indexOf(Handle handle) const;
+        bool isValid(Handle handle) const;
+
+        // Handle slots handed out so far. Slots are recycled, so this is the peak number of live
+        // bullets.
+        unsigned int slotCount() const;
+
+        // Append a fresh, live bullet and return its index.
+        unsigned int add(float x, float y, float vx, float vy);
+
+        // Append `n` fresh, motionless bullets at (x, y) in one go. Returns the index of the
+        // first; the rest follow it.
+        unsigned int addBatch(unsigned int n, float x, float y);
+
+        // Copy position, size and velocity from `origin` into bullet `i`.
+        void set(unsigned int i, const Bullet& origin);
+
+        // Swap the last bullet into slot `i` and shrink by one.
+        void remove(unsigned int i);
+        void removeDead();
+        void clear();
+
+        // Native half of a bullet's frame, run over every bullet once all scripts are done:
+        // move by velocity, kill bullets that left `area`, fade dying bullets and advance turns.
+        // Uses SSE2/AVX when the compiler targets them.
+        void step(const BulletLuaUtils::Rect& area);
+
+        BulletLuaUtils::Rect getRect(unsigned int i) const;
+        void setCenter(unsigned int i, float cx, float cy);
+
+        // Resize the hitbox around its current center.
+        void setHitbox(unsigned int i, float width, float height);
+        void setRadius(unsigned int i, float r);
+
+        bool isDead(unsigned int i) const;
+        bool isDying(unsigned int i) const;
+        void vanish(unsigned int i);
+        void kill(unsigned int i);
+
+        // Kinematics (directions in radians)
+        float getSpeed(unsigned int i) const;
+        void setSpeed(unsigned int i, float speed);
+        void setSpeedRelative(unsigned int i, float speed);
+        void setSpeedAndDirection(unsigned int i, float speed, float dir);
+
+        float getDirection(unsigned int i) const;
+        void setDirection(unsigned int i, float dir);
+        void setDirectionRelative(unsigned int i, float dir);
+
+        float getAimDirection(unsigned int i, float tx, float ty) const;
+        void aimAtPoint(unsigned int i, float tx, float ty);
+
+        void setColor(unsigned int i, unsigned char newR, unsigned char newG, unsigned char newB);
+
+    private:
+        // Give bullet `i` a free slot and return its handle. Throws std::length_error if over
+        // 2^22 - 1 bullets are alive at once.
+        Handle acquireSlot(unsigned int i);
+        void releaseSlot(Handle handle);
+};
+
+#endif // _BulletStore_hpp_
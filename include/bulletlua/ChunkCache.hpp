@@ -0,0 +1,75 @@
+#ifndef _ChunkCache_hpp_
+#define _ChunkCache_hpp_
+
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct lua_State;
+
+// Process-wide cache of compiled scripts, so launching a pattern again doesn't re-read and
+// re-parse its source.
+//
+// Files are keyed by path and modification time, embedded scripts by their contents. Chunks are
+// stored as lua bytecode (lua_dump) and can also be kept in a directory, so a later run of the
+// game starts with them already compiled. Chunk files are named by a hash of their key and start
+// with the key itself, so a file is only used for the exact key it was written for. Only point
+// it at a directory you trust: bytecode is not verified when it is loaded.
+//
+// Files are kept once per path. Embedded scripts are kept up to a limit, oldest dropped first,
+// so scripts generated on the fly don't pile up.
+//
+// The load functions work like luaL_loadfile/luaL_loadstring: they push the compiled chunk (or
+// an error message) and return a lua status code.
+class ChunkCache
+{
+    public:
+        static ChunkCache& instance();
+
+        int loadFile(lua_State* L, const std::string& filename);
+        int loadScript(lua_State* L, const std::string& script);
+
+        // Also read and write chunks in `directory`, which must exist. Empty turns this off.
+        void setDirectory(const std::string& directory);
+
+        // Keep at most `limit` embedded scripts in memory.
+        void setScriptLimit(unsigned int limit);
+
+        // Forget every chunk held in memory. Chunks on disk are kept.
+        void clear();
+        unsigned int size() const;
+
+    private:
+        static const unsigned int DEFAULT_SCRIPT_LIMIT = 256;
+
+        struct FileChunk
+        {
+            std::time_t modified;
+            std::string bytecode;
+        };
+
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, FileChunk> files;
+        std::unordered_map<std::string, std::string> scripts;
+        std::string directory;
+
+        // Keys of `scripts`, oldest first.
+        std::deque<const std::string*> scriptOrder;
+        unsigned int scriptLimit;
+
+        ChunkCache();
+
+        // Drop the oldest scripts until there are no more than scriptLimit.
+        void trimScripts();
+
+        // Load a cached chunk from `directory`. Returns false if there is none (or it is bad).
+        bool loadFromDisk(lua_State* L, const std::string& key, const std::string& name,
+                          std::string& bytecode);
+
+        // Compile into `bytecode` the chunk on top of the stack, and write it to `directory`.
+        void store(lua_State* L, const std::string& key, std::string& bytecode);
+};
+
+#endif // _ChunkCache_hpp_
@@ -0,0 +1,57 @@
+#ifndef _LuaStatePool_hpp_
+#define _LuaStatePool_hpp_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sol.hpp>
+
+// Recycles the lua states root bullets run in.
+//
+// acquire() hands out a state as a shared_ptr, like a freshly made one. When the last bullet
+// using it dies, the state goes back to the pool instead of being closed, which is O(1).
+// Before a recycled state is handed out again, its globals are put back to how they were right
+// after initialization, so patterns don't see each other's globals. So are the library tables
+// among them, the BulletLua API behind them and the string metatable, along with their
+// metatables, so a pattern can't patch them for the next one either. Libraries and the API stay
+// loaded.
+//
+// Garbage a pattern left behind is not collected eagerly; lua's incremental collector picks it
+// up as the state is used again.
+class LuaStatePool
+{
+    public:
+        // Loads libraries and bindings into a new state.
+        typedef std::function<void(sol::state&)> Initializer;
+
+        explicit LuaStatePool(Initializer initializer);
+        ~LuaStatePool();
+
+        // Non-copyable
+        LuaStatePool(const LuaStatePool&) = delete;
+        LuaStatePool& operator=(const LuaStatePool&) = delete;
+
+        std::shared_ptr<sol::state> acquire();
+
+        // Make sure at least `count` initialized states are idle, e.g. at stage start.
+        void prewarm(unsigned int count);
+
+        unsigned int idleCount() const;
+
+    private:
+        // Outlives the pool while states are still out, so released states know where to go.
+        struct Idle
+        {
+            std::vector<sol::state*> states;
+            bool open;
+        };
+
+        Initializer initializer;
+        std::shared_ptr<Idle> idle;
+
+        sol::state* create();
+        static void reset(sol::state& state);
+};
+
+#endif // _LuaStatePool_hpp_
@@ -0,0 +1,103 @@
+#ifndef _ScriptTable_hpp_
+#define _ScriptTable_hpp_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sol.hpp>
+
+// The lua states and functions live bullets run, each stored once.
+//
+// Bullets refer to both by id (see BulletStore::Script), so spawning one costs a couple of
+// counter increments instead of a shared_ptr copy and a registry reference. A function holds
+// one registry reference for as long as any bullet runs it, and a state stays checked out of
+// its pool for as long as any bullet or function uses it. Id 0 means none.
+//
+// Scripts of different states may run on different threads (see ThreadPool). Only interning a
+// function takes a lock, since any of them may do that. Lookups don't: entries never move once
+// added, so they can be read while other threads add more. Users may only be added or dropped,
+// and states added, while no scripts run in parallel; the manager holds changes back until then.
+class ScriptTable
+{
+    public:
+        typedef unsigned int Id;
+
+        static const Id NONE = 0;
+
+        ScriptTable();
+        ~ScriptTable();
+
+        // Non-copyable
+        ScriptTable(const ScriptTable&) = delete;
+        ScriptTable& operator=(const ScriptTable&) = delete;
+
+        // Id of `lua`, adding it if it's new. New ids have no users, so retain them right away.
+        Id state(std::shared_ptr<sol::state> lua);
+
+        // Id of the function at `index` on the stack of `L`, a thread of state `state`. The same
+        // function always gets the same id while it is in use. Raises a lua error if there is no
+        // function there, or no ids are left.
+        Id function(Id state, lua_State* L, int index);
+
+        // Add or drop `n` users. Ids are recycled once nothing uses them anymore.
+        void retainState(Id id, unsigned int n=1);
+        void releaseState(Id id, unsigned int n=1);
+        void retainFunction(Id id, unsigned int n=1);
+        void releaseFunction(Id id, unsigned int n=1);
+
+        // Main thread of state `id`.
+        lua_State* luaState(Id id) const;
+
+        // Push function `id` onto `L`, a thread of its state.
+        void push(lua_State* L, Id id) const;
+
+        unsigned int stateCount() const;
+        unsigned int functionCount() const;
+
+    private:
+        struct State
+        {
+            std::shared_ptr<sol::state> lua;
+            unsigned int users;
+        };
+
+        struct Function
+        {
+            // Registry reference and lua_topointer of the function.
+            int ref;
+            const void* key;
+
+            Id state;
+            unsigned int users;
+        };
+
+        // Functions are stored in blocks of FUNCTION_BLOCK that are never moved or freed before
+        // the table is, so reading one doesn't race with adding another.
+        static const unsigned int FUNCTION_BLOCK_BITS = 10;
+        static const unsigned int FUNCTION_BLOCK = 1 << FUNCTION_BLOCK_BITS;
+        static const unsigned int MAX_FUNCTION_BLOCKS = 1024;
+
+        std::vector<State> states;
+        std::vector<Id> freeStates;
+        std::unordered_map<const sol::state*, Id> stateIds;
+
+        std::unique_ptr<Function[]> functions[MAX_FUNCTION_BLOCKS];
+
+        // One past the highest function id handed out so far.
+        Id functionEnd;
+
+        // Keyed by the function itself, which can't be collected (and its address reused) while
+        // the table references it.
+        std::vector<Id> freeFunctions;
+        std::unordered_map<const void*, Id> functionIds;
+
+        // Guards interning.
+        std::mutex lock;
+
+        Function& functionAt(Id id);
+        const Function& functionAt(Id id) const;
+};
+
+#endif // _ScriptTable_hpp_
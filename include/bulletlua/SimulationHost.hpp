@@ -0,0 +1,94 @@
+#ifndef _SimulationHost_hpp_
+#define _SimulationHost_hpp_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <bulletlua/BulletLuaManager.hpp>
+#include <bulletlua/ThreadPool.hpp>
+#include <bulletlua/Utils/Rect.hpp>
+
+// Runs many independent simulations at once, e.g. to re-simulate submitted replays on a server.
+//
+// Each instance is a manager of its own with its own player rect, and advance() runs every
+// instance as one job on the host's own thread pool, so hosts on different threads never wait
+// for each other. Instances share nothing but the compiled scripts in ChunkCache, which is
+// process-wide; preload() compiles scripts up front so jobs only read from it. Each instance
+// draws random numbers from its own seed, so how it plays out doesn't depend on the other
+// instances or on the number of threads.
+class SimulationHost
+{
+    public:
+        // Builds an instance's manager around its player, e.g. to use a subclass.
+        typedef std::function<std::unique_ptr<BulletLuaManager>(BulletLuaUtils::Rect&)> Factory;
+
+        // Called on the job's thread before instance `instance` runs tick `frame`, e.g. to move
+        // its player along a replay. Only touch that instance from here.
+        typedef std::function<void(unsigned int instance, unsigned int frame,
+                                   BulletLuaManager& manager, BulletLuaUtils::Rect& player)> Input;
+
+        // `workers` threads besides the one calling advance().
+        explicit SimulationHost(unsigned int workers=ThreadPool::defaultWorkers());
+
+        // Non-copyable
+        SimulationHost(const SimulationHost&) = delete;
+        SimulationHost& operator=(const SimulationHost&) = delete;
+
+        // Add a plain manager covering the given area, with `player` as its player. Returns the
+        // instance's index.
+        unsigned int add(int left, int top, int width, int height,
+                         const BulletLuaUtils::Rect& player, std::uint_fast64_t seed);
+
+        // Add the manager `create` builds. It must not run on this host's pool, since advance()
+        // runs its tick() as one of the pool's jobs (see BulletLuaManager::setThreadPool).
+        unsigned int add(const Factory& create, const BulletLuaUtils::Rect& player,
+                         std::uint_fast64_t seed);
+
+        // Remove every instance.
+        void clear();
+
+        unsigned int size() const;
+        BulletLuaManager& manager(unsigned int instance);
+        BulletLuaUtils::Rect& player(unsigned int instance);
+
+        // Ticks instance `instance` has run.
+        unsigned int frame(unsigned int instance) const;
+
+        // Compile a script into the shared cache. Returns false if it doesn't compile.
+        bool preloadFile(const std::string& filename);
+        bool preloadScript(const std::string& script);
+
+        // Run `frames` ticks of every instance, instances in parallel. If an instance throws,
+        // the others still finish and the first exception is rethrown here.
+        void advance(unsigned int frames, const Input& input=Input{});
+
+        // Ticks all instances ran in the last advance(), per second it took.
+        double ticksPerSecond() const;
+
+        // Ticks all instances ran since they were added.
+        unsigned long long totalTicks() const;
+
+        unsigned int threadCount() const;
+
+    private:
+        struct Instance
+        {
+            // Declared first: the manager keeps a reference to it.
+            BulletLuaUtils::Rect player;
+            std::unique_ptr<BulletLuaManager> manager;
+            unsigned int frame;
+        };
+
+        ThreadPool pool;
+
+        // Held by pointer so players stay put as instances are added.
+        std::vector<std::unique_ptr<Instance>> instances;
+
+        unsigned long long ticks;
+        double rate;
+};
+
+#endif // _SimulationHost_hpp_
@@ -0,0 +1,84 @@
+#ifndef _Snapshot_hpp_
+#define _Snapshot_hpp_
+
+#include <atomic>
+#include <vector>
+
+#include <bulletlua/BulletStore.hpp>
+
+// Bullets as they were at the end of one tick, for a renderer or a network thread.
+struct Snapshot
+{
+    // Number of ticks the manager had finished.
+    unsigned int frame;
+
+    // Top-left corner and size of the collision box, and circle radius (0 for a box).
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> w;
+    std::vector<float> h;
+    std::vector<float> radius;
+
+    // Direction of travel in radians.
+    std::vector<float> direction;
+
+    std::vector<int> life;
+
+    // BulletStore::Flag bits: whether a bullet collides, and whether it is fading out.
+    std::vector<unsigned char> flags;
+
+    std::vector<unsigned char> r;
+    std::vector<unsigned char> g;
+    std::vector<unsigned char> b;
+
+    // Identify the same bullet across snapshots, e.g. to interpolate.
+    std::vector<BulletStore::Handle> handles;
+
+    unsigned int size() const;
+
+    // Copy every bullet in `bullets`.
+    void capture(const BulletStore& bullets, unsigned int frame);
+};
+
+// Hands snapshots from the thread that ticks to one thread that reads them, without either
+// waiting for the other.
+//
+// Of the three snapshots, the writer fills one, the reader holds one, and the third is the
+// latest one published. publish() and update() swap with that third one atomically. Snapshots
+// are reused round robin, so once their arrays have grown, publishing doesn't allocate. The
+// reader skips snapshots it was too slow to see.
+class SnapshotBuffer
+{
+    public:
+        SnapshotBuffer();
+
+        // Non-copyable
+        SnapshotBuffer(const SnapshotBuffer&) = delete;
+        SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+
+        // Writer: fill back(), then publish() it. The next back() is a different snapshot.
+        Snapshot& back();
+        void publish();
+
+        // Reader: switch to the latest published snapshot, if there is a new one. Returns false
+        // if there isn't, and front() stays the same.
+        bool update();
+
+        // The snapshot the reader holds. It doesn't change until the next update(). Empty before
+        // the first one.
+        const Snapshot& front() const;
+
+    private:
+        // Set in `middle` while the snapshot there hasn't been read.
+        static const unsigned int FRESH = 4;
+
+        Snapshot snapshots[3];
+
+        unsigned int writing;
+        unsigned int reading;
+
+        // Index of the latest published snapshot, or'd with FRESH.
+        std::atomic<unsigned int> middle;
+};
+
+#endif // _Snapshot_hpp_
@@ -1,50 +1,199 @@
 #ifndef _SpacialPartition_hpp_
 #define _SpacialPartition_hpp_
 
+#include <vector>
+
+#include <bulletlua/BulletStore.hpp>
+#include <bulletlua/ThreadPool.hpp>
 #include <bulletlua/Utils/Rect.hpp>
 
-class Bullet;
+// Everything SpacialPartition::query learned about the bullets around a target.
+struct CollisionResult
+{
+    // Bullets touching the target. May be larger than the caller's buffer.
+    unsigned int hits;
+
+    // Bullets within the graze radius that don't touch the target.
+    unsigned int grazes;
+
+    // Gap between the target and the closest bullet within the graze radius (0 on a hit),
+    // or FLT_MAX if there is none.
+    float nearest;
+};
 
 // Very simple collision detection.
-// Cuts a region into a fixed amount of tiles so collision detection only
+// Cuts a region into a uniform grid of tiles so collision detection only
 // needs to compare against elements located in the same tile.
 // While the worst-case runtime is O(n^2) , where ALL bullets are located in
 // the same tile (O(n) to add all bullets, O(n) to check against all bullets in a tile),
 // this simple solution suits my needs for now.
+//
+// The grid is rebuilt from scratch each frame with a counting sort: one pass counts bullets per
+// tile, a prefix sum turns the counts into offsets, and a second pass scatters bullet indices
+// into one flat array (compressed sparse row layout). Tiles have no capacity limit and the
+// index array is only as large as the number of collidable bullets.
+//
+// A bullet is binned into every tile its bounding box overlaps, and queries visit every tile the
+// query box overlaps. A bullet/query pair that shares several tiles is only tested in the first
+// of them (the top-left tile of the overlap), so nothing is tested twice.
+//
+// Bullets are boxes or circles (BulletStore::radius). build() copies each entry's normalized
+// bounds next to it, so the narrow phase never has to touch the store or normalize a Rect.
+//
+// With swept collision on, bullets that moved further than their own hitbox size this frame are
+// tested along the whole path from their previous position, so they can't skip over a target.
+// Slow bullets keep the plain end-of-frame test.
+//
+// Given a thread pool, large builds run each step in parallel: every thread counts a contiguous
+// chunk of bullets into a histogram of its own, tiles are split into ranges for the prefix sum,
+// and each chunk scatters into its own slots of every tile. Tiles list their bullets in index
+// order either way, so the result is the same as a single-threaded build.
+//
+// The grid covers the area passed to the constructor (which may start at negative
+// coordinates). Tile size can be set explicitly, or retuned from the bullet count with tune().
 class SpacialPartition
 {
     private:
-        static constexpr unsigned int tileSize = 50;
-        static constexpr int WIDTH  = 640 / tileSize;
-        static constexpr int HEIGHT = 480 / tileSize;
-        static constexpr int CAP = 100;
+        // Inclusive range of tiles covered by a box. x0 < 0 means "not binned".
+        struct TileRange
+        {
+            int x0, y0;
+            int x1, y1;
+        };
+
+        // Normalized hitbox of a binned bullet. radius > 0 marks a circle centered in the box.
+        // A swept bullet's center moved by (sweepX, sweepY) to get here; zero for other bullets.
+        struct Shape
+        {
+            float minX, minY;
+            float maxX, maxY;
+            float radius;
+            float sweepX, sweepY;
+        };
+
+        static constexpr float DEFAULT_TILE_SIZE = 50.0f;
+        static constexpr float MIN_TILE_SIZE = 16.0f;
+        static constexpr float MAX_TILE_SIZE = 256.0f;
+
+        // Average number of bullets per tile tune() aims for.
+        static constexpr float TARGET_DENSITY = 8.0f;
+
+        float tileSize;
+        float invTileSize;
+        int columns;
+        int rows;
 
-        // Out of bounds error waiting to happen...
-        const Bullet* space[WIDTH][HEIGHT][CAP];
-        int bulletCount[WIDTH][HEIGHT];
+        // Bullets in tile `c` are entries[cellStart[c]] up to entries[cellStart[c + 1]].
+        // Entries are indices into `bullets`, only valid until the store removes a bullet.
+        std::vector<unsigned int> cellStart;
+        std::vector<unsigned int> entries;
+        std::vector<Shape> shapes;
+
+        // Tiles covered by each bullet and its hitbox, indexed like `bullets`. Rebuilt by build().
+        std::vector<TileRange> spans;
+        std::vector<Shape> bulletShapes;
+
+        // Scratch space for build(): the next free entry in each tile.
+        std::vector<unsigned int> cellFill;
+
+        // Scratch space for parallel builds: each chunk's count and then next free entry in each
+        // tile (chunkCells[chunk * tiles + tile]), and the first entry of each range of tiles.
+        std::vector<unsigned int> chunkCells;
+        std::vector<unsigned int> rangeStart;
+
+        // Not owned. Null builds on the calling thread.
+        ThreadPool* pool;
+
+        bool swept;
+
+        const BulletStore& bullets;
+
+        // Only bullets on this layer are binned.
+        CollisionLayer layer;
 
         BulletLuaUtils::Rect screenArea;
 
+        // Top-left corner of the grid, i.e. screenArea with its size normalized.
+        float left;
+        float top;
+
     public:
-        SpacialPartition(const BulletLuaUtils::Rect& area);
-        // SpacialPartition(int width, int height);
+        // Smaller builds aren't worth waking the pool for.
+        static constexpr unsigned int PARALLEL_THRESHOLD = 8192;
+
+        SpacialPartition(const BulletStore& store, const BulletLuaUtils::Rect& area,
+                         CollisionLayer layer=ENEMY_BULLETS, float tileSize=DEFAULT_TILE_SIZE);
 
         SpacialPartition(const SpacialPartition&) = delete;
         SpacialPartition& operator=(const SpacialPartition&) = delete;
 
-        void addBullet(const Bullet* bullet);
+        // Rebuild the grid with a new tile size. Clears all bullets.
+        void setTileSize(float size);
+        float getTileSize() const;
+
+        // Pick a tile size for `bulletCount` bullets spread over the area. Only rebuilds the grid
+        // if the ideal size differs from the current one by more than a factor of two.
+        void tune(unsigned int bulletCount);
+
+        // Test fast bullets along their path this frame.
+        void setSweptCollision(bool enabled);
+        bool getSweptCollision() const;
+
+        int getColumns() const;
+        int getRows() const;
 
-        // Lazy delete all bullets.
+        // Bin every live, collidable bullet on this grid's layer.
+        void build();
+
+        // Build large grids on `pool` from now on, or on the calling thread if it is null. The
+        // pool must outlive its use here.
+        void setThreadPool(ThreadPool* pool);
+
+        // Remove all bullets.
         void reset();
 
+        // Number of bullets binned by the last build().
+        unsigned int entryCount() const;
+
         // Checks if bullet is still in the testable area
         bool checkOutOfBounds(const BulletLuaUtils::Rect& b) const;
+        const BulletLuaUtils::Rect& getArea() const;
 
-        // Point-to-point collision test.
+        // Rect-to-bullet collision test. `b` may span any number of tiles.
         bool checkCollision(const BulletLuaUtils::Rect& b) const;
 
+        // Circle-to-bullet collision test.
+        bool checkCollision(float cx, float cy, float radius) const;
+
+        // Full collision query in a single pass over the affected tiles. Handles of the bullets
+        // hitting `b` are written to `hits`, up to `capacity` of them.
+        CollisionResult query(const BulletLuaUtils::Rect& b, float grazeRadius,
+                              BulletStore::Handle* hits, unsigned int capacity) const;
+
         // Point-to-rect collision test.
         bool checkCollision(int x, int y, int width, int height) = delete;
+
+    private:
+        // Tile coordinate containing world coordinate `x`/`y`. May be out of range.
+        int column(float x) const;
+        int row(float y) const;
+
+        // Compute bullet `i`'s shape and tiles. False if it isn't binned.
+        bool bin(unsigned int i);
+
+        void buildParallel();
+
+        // Tiles overlapped by a box, clamped to the grid. False if the box misses the grid.
+        bool tileRange(float minX, float minY, float maxX, float maxY, TileRange& range) const;
+
+        // Narrow phase against a normalized box or a circle.
+        static bool intersectsBox(const Shape& s, float minX, float minY, float maxX, float maxY);
+        static bool intersectsCircle(const Shape& s, float cx, float cy, float radius);
+
+        // Call `f(index, shape)` once for every bullet sharing a tile with the given box, until it
+        // returns true. Returns whether `f` stopped the search.
+        template <typename F>
+        bool forEachCandidate(float minX, float minY, float maxX, float maxY, F f) const;
 };
 
 #endif // _SpacialPartition_hpp_
@@ -0,0 +1,75 @@
+#ifndef _ThreadPool_hpp_
+#define _ThreadPool_hpp_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for running a batch of independent jobs.
+//
+// run() deals its jobs round robin into one queue per thread. Each thread works through its own
+// queue and then steals from the back of the others, so a few long jobs don't leave the rest of
+// the pool idle. The calling thread works too, so a pool without workers just runs everything
+// in order on the caller.
+class ThreadPool
+{
+    public:
+        typedef std::function<void(unsigned int)> Job;
+
+        // `workers` threads besides the caller. By default, one less than the hardware has.
+        explicit ThreadPool(unsigned int workers=defaultWorkers());
+        ~ThreadPool();
+
+        // Non-copyable
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Call job(i) for every i in [0, count) and wait for all of them. If jobs throw, the
+        // first exception is rethrown here once the others are done. Callers on different
+        // threads take turns, so a pool can be shared. Not reentrant: a job that calls run() on
+        // its own pool gets std::logic_error, since it would wait for itself.
+        void run(unsigned int count, const Job& job);
+
+        // Number of threads that run jobs, including the caller.
+        unsigned int size() const;
+
+        static unsigned int defaultWorkers();
+
+    private:
+        struct Queue
+        {
+            std::mutex lock;
+            std::deque<unsigned int> jobs;
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+
+        // Held by the run() call using the queues.
+        std::mutex calls;
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        const Job* job;
+        unsigned int generation;
+        bool stopping;
+
+        std::atomic<unsigned int> remaining;
+        std::exception_ptr error;
+
+        void work(unsigned int self);
+
+        // Run one job from thread `self`'s queue, or one stolen from another. Returns false if
+        // there was none left.
+        bool runOne(unsigned int self);
+};
+
+#endif // _ThreadPool_hpp_
@@ -0,0 +1,64 @@
+#ifndef _TimingWheel_hpp_
+#define _TimingWheel_hpp_
+
+#include <vector>
+
+#include <bulletlua/BulletStore.hpp>
+
+// Hierarchical timing wheel of bullets waiting for a future frame.
+//
+// Level 0 has one slot per frame for the next 256 frames, level 1 one slot per 256 frames for
+// the next 64 of those, and level 2 one slot per 16384 frames. Anything further out waits in an
+// overflow list. Scheduling is O(1); each bullet is moved down a level at most twice before it
+// comes due.
+class TimingWheel
+{
+    public:
+        TimingWheel();
+
+        // Wake `handle` on frame `when`, which must not be earlier than now().
+        void schedule(BulletStore::Handle handle, unsigned int when);
+
+        // Append every bullet due on frame now() to `due`, then move on to the next frame.
+        void advance(std::vector<BulletStore::Handle>& due);
+
+        unsigned int now() const;
+        unsigned int size() const;
+
+        // Drop every scheduled bullet. The frame counter keeps going.
+        void clear();
+
+    private:
+        static const unsigned int SLOT_BITS = 8;
+        static const unsigned int LEVEL_BITS = 6;
+
+        static const unsigned int SLOTS = 1u << SLOT_BITS;
+        static const unsigned int LEVEL_SLOTS = 1u << LEVEL_BITS;
+
+        static const unsigned int LEVEL1_SHIFT = SLOT_BITS;
+        static const unsigned int LEVEL2_SHIFT = SLOT_BITS + LEVEL_BITS;
+        static const unsigned int OVERFLOW_SHIFT = SLOT_BITS + 2 * LEVEL_BITS;
+
+        struct Entry
+        {
+            BulletStore::Handle handle;
+            unsigned int when;
+        };
+
+        typedef std::vector<Entry> Slot;
+
+        std::vector<Slot> level0;
+        std::vector<Slot> level1;
+        std::vector<Slot> level2;
+        Slot overflow;
+
+        unsigned int frame;
+        unsigned int count;
+
+        void place(const Entry& entry);
+
+        // Re-place the entries of `slot` now that they are closer.
+        void cascade(Slot& slot);
+};
+
+#endif // _TimingWheel_hpp_
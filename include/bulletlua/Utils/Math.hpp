@@ -2,6 +2,7 @@
 #define _Math_hpp_
 
 #include <cmath>
+#include <cfloat>
 
 namespace Math
 {
@@ -55,6 +56,64 @@ namespace Math
 
     /* inline float getX(float d, float m); */
     /* inline float getY(float d, float m); */
+
+    // Velocity helpers shared by Bullet and BulletStore.
+    // Unlike the functions above, directions here are in radians, measured clockwise from "up".
+    inline float getSpeed(float vx, float vy)
+    {
+        return std::sqrt(vx * vx + vy * vy);
+    }
+
+    inline float getDirection(float vx, float vy)
+    {
+        return PI - std::atan2(vx, vy);
+    }
+
+    inline float getAimDirection(float x, float y, float tx, float ty)
+    {
+        return PI - std::atan2(tx - x, ty - y);
+    }
+
+    // Adjust speed if near zero as setDirection depends on at least one component
+    // of our velocity vector is non-zero.
+    // See https://randomascii.wordpress.com/2012/02/25/comparing-floating-point-numbers-2012-edition/
+    inline void fixSpeed(float& vy)
+    {
+        if (std::abs(vy) < FLT_EPSILON)
+        {
+            vy = FLT_EPSILON;
+        }
+    }
+
+    inline void setSpeedAndDirection(float& vx, float& vy, float speed, float dir)
+    {
+        vx = speed * std::sin(dir);
+        vy = -speed * std::cos(dir);
+
+        fixSpeed(vy);
+    }
+
+    inline void setSpeed(float& vx, float& vy, float speed)
+    {
+        float mag = getSpeed(vx, vy);
+
+        vx = (vx * speed) / mag;
+        vy = (vy * speed) / mag;
+
+        fixSpeed(vy);
+    }
+
+    inline void setSpeedRelative(float& vx, float& vy, float speed)
+    {
+        setSpeed(vx, vy, speed + getSpeed(vx, vy));
+    }
+
+    inline void setDirection(float& vx, float& vy, float dir)
+    {
+        float speed = getSpeed(vx, vy);
+        vx = speed * std::sin(dir);
+        vy = -speed * std::cos(dir);
+    }
 }
 
 #endif // _Math_hpp_
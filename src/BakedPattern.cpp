@@ -0,0 +1,342 @@
+#include <bulletlua/BakedPattern.hpp>
+
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    const char MAGIC[4] = {'B', 'L', 'B', 'K'};
+    const unsigned int VERSION = 1;
+
+    const unsigned char KEY_FLAGS = BulletStore::Collision | BulletStore::Dying;
+
+    template <typename T>
+    void write(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void read(std::istream& in, T& value)
+    {
+        in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    }
+
+    // Bytes a track and a key take up in a file.
+    const unsigned long long TRACK_BYTES = 4 * sizeof(unsigned int);
+    const unsigned long long KEY_BYTES = sizeof(unsigned int) + 7 * sizeof(float) + 6;
+
+    // Bytes left between the read position and the end of the file.
+    unsigned long long remaining(std::istream& in)
+    {
+        std::streamoff here = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::streamoff end = in.tellg();
+        in.seekg(here);
+
+        return end > here ? end - here : 0;
+    }
+
+    BakedPattern::Key keyOf(const BulletStore& bullets, unsigned int i, unsigned int frame)
+    {
+        return BakedPattern::Key{frame,
+                bullets.x[i], bullets.y[i],
+                bullets.vx[i], bullets.vy[i],
+                bullets.w[i], bullets.h[i],
+                bullets.radius[i],
+                static_cast<unsigned char>(bullets.flags[i] & KEY_FLAGS),
+                static_cast<unsigned char>(bullets.life[i]),
+                bullets.layer[i],
+                bullets.r[i], bullets.g[i], bullets.b[i]};
+    }
+
+    // Whether anything but the position (or the fade, which step() drives) differs.
+    bool changed(const BakedPattern::Key& a, const BakedPattern::Key& b)
+    {
+        return a.vx != b.vx || a.vy != b.vy ||
+            a.w != b.w || a.h != b.h || a.radius != b.radius ||
+            a.flags != b.flags || a.layer != b.layer ||
+            a.r != b.r || a.g != b.g || a.b != b.b;
+    }
+
+    void applyKey(BulletStore& bullets, unsigned int i, const BakedPattern::Key& key)
+    {
+        bullets.x[i] = key.x;
+        bullets.y[i] = key.y;
+        bullets.vx[i] = key.vx;
+        bullets.vy[i] = key.vy;
+        bullets.w[i] = key.w;
+        bullets.h[i] = key.h;
+        bullets.radius[i] = key.radius;
+        bullets.flags[i] = (bullets.flags[i] & ~KEY_FLAGS) | key.flags;
+        bullets.life[i] = key.life;
+        bullets.layer[i] = key.layer;
+        bullets.setColor(i, key.r, key.g, key.b);
+    }
+}
+
+const unsigned int BakedPattern::FOREVER;
+
+BakedPattern::BakedPattern()
+    : frames{0},
+      tracks{},
+      keys{}
+{
+}
+
+bool BakedPattern::save(const std::string& filename) const
+{
+    std::ofstream out{filename, std::ios::binary};
+
+    out.write(MAGIC, sizeof(MAGIC));
+    write(out, VERSION);
+    write(out, frames);
+    write(out, static_cast<unsigned int>(tracks.size()));
+    write(out, static_cast<unsigned int>(keys.size()));
+
+    for (const Track& track : tracks)
+    {
+        write(out, track.spawn);
+        write(out, track.end);
+        write(out, track.firstKey);
+        write(out, track.keyCount);
+    }
+
+    // Field by field, so struct padding never ends up in the file.
+    for (const Key& key : keys)
+    {
+        write(out, key.frame);
+        write(out, key.x);
+        write(out, key.y);
+        write(out, key.vx);
+        write(out, key.vy);
+        write(out, key.w);
+        write(out, key.h);
+        write(out, key.radius);
+        write(out, key.flags);
+        write(out, key.life);
+        write(out, key.layer);
+        write(out, key.r);
+        write(out, key.g);
+        write(out, key.b);
+    }
+
+    return bool(out);
+}
+
+bool BakedPattern::load(const std::string& filename)
+{
+    std::ifstream in{filename, std::ios::binary};
+
+    char magic[sizeof(MAGIC)];
+    unsigned int version = 0;
+    unsigned int trackCount = 0;
+    unsigned int keyCount = 0;
+
+    in.read(magic, sizeof(magic));
+    read(in, version);
+    if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION)
+        return false;
+
+    read(in, frames);
+    read(in, trackCount);
+    read(in, keyCount);
+    if (!in)
+        return false;
+
+    // Don't trust the counts with an allocation before checking the file is that long.
+    if (trackCount * TRACK_BYTES + keyCount * KEY_BYTES > remaining(in))
+        return false;
+
+    tracks.resize(trackCount);
+    unsigned int lastSpawn = 0;
+    for (Track& track : tracks)
+    {
+        read(in, track.spawn);
+        read(in, track.end);
+        read(in, track.firstKey);
+        read(in, track.keyCount);
+
+        if (track.keyCount == 0 || track.firstKey > keyCount ||
+            track.keyCount > keyCount - track.firstKey)
+            return false;
+
+        // PatternPlayer spawns tracks in this order and only on their exact frame, so one out of
+        // order would never be reached. A track must also end after it starts.
+        if (track.spawn < lastSpawn || (track.end != FOREVER && track.end <= track.spawn))
+            return false;
+
+        lastSpawn = track.spawn;
+    }
+
+    keys.resize(keyCount);
+    for (Key& key : keys)
+    {
+        read(in, key.frame);
+        read(in, key.x);
+        read(in, key.y);
+        read(in, key.vx);
+        read(in, key.vy);
+        read(in, key.w);
+        read(in, key.h);
+        read(in, key.radius);
+        read(in, key.flags);
+        read(in, key.life);
+        read(in, key.layer);
+        read(in, key.r);
+        read(in, key.g);
+        read(in, key.b);
+    }
+
+    if (!in)
+        return false;
+
+    // PatternPlayer spawns a bullet with its track's first key and steps through the rest in
+    // frame order.
+    for (const Track& track : tracks)
+    {
+        if (keys[track.firstKey].frame != track.spawn)
+            return false;
+
+        for (unsigned int k = track.firstKey + 1; k < track.firstKey + track.keyCount; ++k)
+        {
+            if (keys[k].frame <= keys[k - 1].frame)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+PatternRecorder::PatternRecorder()
+    : frame{0},
+      tracks{},
+      trackKeys{},
+      open{}
+{
+}
+
+void PatternRecorder::capture(const BulletStore& bullets)
+{
+    for (auto& entry : open)
+    {
+        entry.second.seen = false;
+    }
+
+    for (unsigned int i = 0; i < bullets.size(); ++i)
+    {
+        BakedPattern::Key key = keyOf(bullets, i, frame);
+        auto found = open.find(bullets.handles[i]);
+
+        if (found == open.end())
+        {
+            unsigned int track = tracks.size();
+            tracks.push_back(BakedPattern::Track{frame, BakedPattern::FOREVER, 0, 0});
+            trackKeys.emplace_back(1, key);
+
+            open.emplace(bullets.handles[i], Open{track, key.x, key.y, true});
+            continue;
+        }
+
+        Open& state = found->second;
+        state.seen = true;
+
+        std::vector<BakedPattern::Key>& keys = trackKeys[state.track];
+        state.x += keys.back().vx;
+        state.y += keys.back().vy;
+
+        if (key.x != state.x || key.y != state.y || changed(key, keys.back()))
+        {
+            keys.push_back(key);
+            state.x = key.x;
+            state.y = key.y;
+        }
+    }
+
+    // Whatever wasn't seen was removed this frame.
+    for (auto it = open.begin(); it != open.end();)
+    {
+        if (it->second.seen)
+        {
+            ++it;
+            continue;
+        }
+
+        tracks[it->second.track].end = frame;
+        it = open.erase(it);
+    }
+
+    ++frame;
+}
+
+BakedPattern PatternRecorder::finish()
+{
+    BakedPattern pattern;
+    pattern.frames = frame;
+    pattern.tracks = tracks;
+
+    // Tracks were created in spawn order already; lay their keys out one track after another.
+    for (unsigned int t = 0; t < tracks.size(); ++t)
+    {
+        pattern.tracks[t].firstKey = pattern.keys.size();
+        pattern.tracks[t].keyCount = trackKeys[t].size();
+        pattern.keys.insert(pattern.keys.end(), trackKeys[t].begin(), trackKeys[t].end());
+    }
+
+    return pattern;
+}
+
+PatternPlayer::PatternPlayer(std::shared_ptr<const BakedPattern> pattern)
+    : pattern{pattern},
+      frame{0},
+      nextTrack{0},
+      live{}
+{
+}
+
+void PatternPlayer::advance(BulletStore& bullets, const std::function<unsigned int()>& spawn)
+{
+    for (unsigned int n = 0; n < live.size();)
+    {
+        Live& l = live[n];
+        const BakedPattern::Track& track = pattern->tracks[l.track];
+        unsigned int i = bullets.indexOf(l.handle);
+
+        // Gone already (e.g. culled by step), or removed on this frame of the recording.
+        if (i == BulletStore::INVALID_INDEX || track.end == frame)
+        {
+            if (i != BulletStore::INVALID_INDEX)
+                bullets.kill(i);
+
+            live[n] = live.back();
+            live.pop_back();
+            continue;
+        }
+
+        if (l.nextKey < track.firstKey + track.keyCount && pattern->keys[l.nextKey].frame == frame)
+        {
+            applyKey(bullets, i, pattern->keys[l.nextKey]);
+            ++l.nextKey;
+        }
+
+        ++n;
+    }
+
+    while (nextTrack < pattern->tracks.size() && pattern->tracks[nextTrack].spawn == frame)
+    {
+        const BakedPattern::Track& track = pattern->tracks[nextTrack];
+
+        unsigned int i = spawn();
+        applyKey(bullets, i, pattern->keys[track.firstKey]);
+        live.push_back(Live{bullets.handles[i], nextTrack, track.firstKey + 1});
+
+        ++nextTrack;
+    }
+
+    ++frame;
+}
+
+bool PatternPlayer::finished() const
+{
+    return nextTrack == pattern->tracks.size() && live.empty();
+}
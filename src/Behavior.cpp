@@ -0,0 +1,195 @@
+#include <bulletlua/Behavior.hpp>
+#include <bulletlua/BulletStore.hpp>
+
+#include <bulletlua/Utils/Math.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+    // Fold 32 bits into an FNV-1a hash, a word at a time.
+    inline void mix(std::uint64_t& hash, std::uint32_t bits)
+    {
+        hash = (hash ^ bits) * 1099511628211ull;
+    }
+
+    // Both zeros compare equal, so they hash alike too.
+    inline void mix(std::uint64_t& hash, float value)
+    {
+        std::uint32_t bits = 0;
+        if (value != 0.0f)
+            std::memcpy(&bits, &value, sizeof(bits));
+
+        mix(hash, bits);
+    }
+
+    // Rotate (x, y) clockwise (on screen) by the angle with the given cosine and sine.
+    inline void rotate(float& x, float& y, float c, float s)
+    {
+        float rx = x * c - y * s;
+        float ry = x * s + y * c;
+
+        x = rx;
+        y = ry;
+    }
+
+    inline void rotate(float& x, float& y, float angle)
+    {
+        rotate(x, y, std::cos(angle), std::sin(angle));
+    }
+}
+
+Behavior::Behavior()
+    : turn{0.0f},
+      accel{0.0f},
+      minSpeed{0.0f},
+      maxSpeed{FLT_MAX},
+      life{0},
+      homing{0.0f},
+      amplitude{0.0f},
+      period{0.0f},
+      orbit{0.0f},
+      orbitX{0.0f},
+      orbitY{0.0f},
+      turnCos{1.0f},
+      turnSin{0.0f},
+      orbitCos{1.0f},
+      orbitSin{0.0f}
+{
+}
+
+bool Behavior::operator==(const Behavior& other) const
+{
+    return turn == other.turn &&
+        accel == other.accel &&
+        minSpeed == other.minSpeed &&
+        maxSpeed == other.maxSpeed &&
+        life == other.life &&
+        homing == other.homing &&
+        amplitude == other.amplitude &&
+        period == other.period &&
+        orbit == other.orbit &&
+        orbitX == other.orbitX &&
+        orbitY == other.orbitY;
+}
+
+std::size_t Behavior::Hash::operator()(const Behavior& behavior) const
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    mix(hash, behavior.turn);
+    mix(hash, behavior.accel);
+    mix(hash, behavior.minSpeed);
+    mix(hash, behavior.maxSpeed);
+    mix(hash, std::uint32_t(behavior.life));
+    mix(hash, behavior.homing);
+    mix(hash, behavior.amplitude);
+    mix(hash, behavior.period);
+    mix(hash, behavior.orbit);
+    mix(hash, behavior.orbitX);
+    mix(hash, behavior.orbitY);
+
+    return std::size_t(hash);
+}
+
+void Behavior::prepare()
+{
+    turnCos = std::cos(turn);
+    turnSin = std::sin(turn);
+    orbitCos = std::cos(orbit);
+    orbitSin = std::sin(orbit);
+}
+
+void Behavior::apply(BulletStore& bullets, const unsigned int* indices, unsigned int count,
+                     const float* tx, const float* ty) const
+{
+    float* vx = bullets.vx.data();
+    float* vy = bullets.vy.data();
+    const int* turns = bullets.turn.data();
+
+    if (orbit != 0.0f)
+    {
+        // Velocity that carries the center around the orbit this frame.
+        for (unsigned int k = 0; k < count; ++k)
+        {
+            unsigned int i = indices[k];
+            float dx = bullets.x[i] + bullets.w[i] / 2 - orbitX;
+            float dy = bullets.y[i] + bullets.h[i] / 2 - orbitY;
+            float rx = dx;
+            float ry = dy;
+            rotate(rx, ry, orbitCos, orbitSin);
+
+            vx[i] = rx - dx;
+            vy[i] = ry - dy;
+        }
+    }
+    else
+    {
+        if (turn != 0.0f)
+        {
+            for (unsigned int k = 0; k < count; ++k)
+            {
+                unsigned int i = indices[k];
+                rotate(vx[i], vy[i], turnCos, turnSin);
+            }
+        }
+
+        if (homing != 0.0f)
+        {
+            for (unsigned int k = 0; k < count; ++k)
+            {
+                unsigned int i = indices[k];
+                float cx = bullets.x[i] + bullets.w[i] / 2;
+                float cy = bullets.y[i] + bullets.h[i] / 2;
+                float delta = Math::getAimDirection(cx, cy, tx[k], ty[k]) -
+                    Math::getDirection(vx[i], vy[i]);
+
+                // Shortest way around.
+                delta = std::remainder(delta, Math::TWO_PI);
+                if (delta > homing)
+                    delta = homing;
+                else if (delta < -homing)
+                    delta = -homing;
+
+                rotate(vx[i], vy[i], delta);
+            }
+        }
+
+        if (period != 0.0f)
+        {
+            float phase = Math::TWO_PI / period;
+            for (unsigned int k = 0; k < count; ++k)
+            {
+                unsigned int i = indices[k];
+                unsigned int t = turns[i];
+                float angle = amplitude * (std::sin(phase * (t + 1)) - std::sin(phase * t));
+                rotate(vx[i], vy[i], angle);
+            }
+        }
+
+        if (accel != 0.0f || minSpeed > 0.0f || maxSpeed < FLT_MAX)
+        {
+            for (unsigned int k = 0; k < count; ++k)
+            {
+                unsigned int i = indices[k];
+                float speed = Math::getSpeed(vx[i], vy[i]) + accel;
+                if (speed < minSpeed)
+                    speed = minSpeed;
+                else if (speed > maxSpeed)
+                    speed = maxSpeed;
+
+                Math::setSpeed(vx[i], vy[i], speed);
+            }
+        }
+    }
+
+    if (life != 0)
+    {
+        for (unsigned int k = 0; k < count; ++k)
+        {
+            unsigned int i = indices[k];
+            if ((unsigned int)turns[i] >= life)
+                bullets.vanish(i);
+        }
+    }
+}
@@ -1,7 +1,6 @@
 #include <bulletlua/Bullet.hpp>
 
 #include <bulletlua/Utils/Math.hpp>
-#include <cfloat>
 
 Bullet::Bullet(float x, float y, float vx, float vy)
     : position{x - 2.0f, y - 2.0f, 4.0f, 4.0f}, // TODO: Un-hard-code bullet metrics.
@@ -10,7 +9,7 @@ Bullet::Bullet(float x, float y, float vx, float vy)
       r{255}, g{255}, b{255},
       dying{true}, life{0}, turn{0}, collisionCheck{false}
 {
-    fixSpeed();
+    Math::fixSpeed(this->vy);
 }
 
 void Bullet::setPosition(float cx, float cy)
@@ -26,43 +25,28 @@ void Bullet::setVelocity(float nvx, float nvy)
 
 void Bullet::setSpeedAndDirection(float speed, float dir)
 {
-    vx = speed * std::sin(dir);
-    vy = -speed * std::cos(dir);
-
-    fixSpeed();
+    Math::setSpeedAndDirection(vx, vy, speed, dir);
 }
 
 void Bullet::setSpeed(float speed)
 {
-    float mag = getSpeed();
-
-    vx = (vx * speed) / mag;
-    vy = (vy * speed) / mag;
-
-    fixSpeed();
+    Math::setSpeed(vx, vy, speed);
 }
 
 void Bullet::setSpeedRelative(float speed)
 {
-    float mag = getSpeed();
-
-    vx = (vx * (speed + mag)) / mag;
-    vy = (vy * (speed + mag)) / mag;
-
-    fixSpeed();
+    Math::setSpeedRelative(vx, vy, speed);
 }
 
 float Bullet::getSpeed() const
 {
-    return std::sqrt(vx * vx + vy * vy);
+    return Math::getSpeed(vx, vy);
 }
 
 
 void Bullet::setDirection(float dir)
 {
-    float speed = getSpeed();
-    vx = speed * std::sin(dir);
-    vy = -speed * std::cos(dir);
+    Math::setDirection(vx, vy, dir);
 }
 
 
@@ -74,21 +58,18 @@ void Bullet::setDirectionRelative(float dir)
 
 void Bullet::aimAtPoint(float tx, float ty)
 {
-    // TODO: use getDirectionAim
-    setDirection(Math::PI -
-                 std::atan2(tx - position.x,
-                            ty - position.y));
+    setDirection(getAimDirection(tx, ty));
 }
 
 float Bullet::getAimDirection(float tx, float ty)
 {
-    return Math::PI - std::atan2(tx - position.x, ty - position.y);
+    return Math::getAimDirection(position.x, position.y, tx, ty);
 }
 
 
 float Bullet::getDirection() const
 {
-    return Math::PI - std::atan2(vx, vy);
+    return Math::getDirection(vx, vy);
 }
 
 
@@ -134,14 +115,3 @@ void Bullet::update()
     position.x += vx;
     position.y += vy;
 }
-
-void Bullet::fixSpeed()
-{
-    // See https://randomascii.wordpress.com/2012/02/25/comparing-floating-point-numbers-2012-edition/
-    // Setting direction (alone) is dependent on components, so if speed is set to 0.0f,
-    // setting a direction will not do anything.
-    if (std::abs(vy) < FLT_EPSILON)
-    {
-        vy = FLT_EPSILON;
-    }
-}
@@ -0,0 +1,885 @@
+#include <bulletlua/BulletLuaApi.hpp>
+#include <bulletlua/BulletLuaManager.hpp>
+
+#include <bulletlua/Utils/Math.hpp>
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <new>
+
+namespace
+{
+    // Registry name of the metatable of behavior objects, which hold a Behavior. They are
+    // interned when a bullet takes them on, so ids are only held by bullets.
+    const char* const BEHAVIOR = "BulletLua.Behavior";
+
+    // What `rate` means for each Behavior constructor.
+    enum BehaviorKind
+    {
+        TURN,
+        ACCELERATE,
+        HOMING,
+        WAVE,
+        ORBIT
+    };
+
+    float field(lua_State* L, const char* name, float fallback)
+    {
+        lua_getfield(L, 1, name);
+        float value = lua_isnil(L, -1) ? fallback : float(luaL_checknumber(L, -1));
+        lua_pop(L, 1);
+
+        // NaN never compares equal, so it couldn't be shared.
+        if (std::isnan(value))
+            luaL_argerror(L, 1, "behavior parameters must be numbers");
+
+        return value;
+    }
+
+    // Arguments of one API call: which bullet it targets and where its real arguments start.
+    struct Call
+    {
+        lua_State* L;
+        BulletLuaManager& manager;
+
+        // Index into the store, or BulletStore::INVALID_INDEX if the bullet is gone.
+        unsigned int bullet;
+
+        // Stack index of the first argument after the (optional) bullet object.
+        int first;
+
+        explicit Call(lua_State* L)
+            : L{L},
+              manager(*static_cast<BulletLuaManager*>(lua_touserdata(L, lua_upvalueindex(1)))),
+              bullet{BulletStore::INVALID_INDEX},
+              first{1}
+        {
+        }
+
+        bool valid() const
+        {
+            return bullet != BulletStore::INVALID_INDEX;
+        }
+
+        float number(int n) const
+        {
+            return float(luaL_checknumber(L, first + n));
+        }
+
+        lua_Integer integer(int n) const
+        {
+            return luaL_checkinteger(L, first + n);
+        }
+    };
+}
+
+// The lua_CFunctions themselves. Nested in BulletLuaApi for access to the manager's internals.
+struct BulletLuaApi::Functions
+{
+    static Call begin(lua_State* L)
+    {
+        Call c{L};
+
+        if (lua_islightuserdata(L, 1))
+        {
+            std::uintptr_t handle = reinterpret_cast<std::uintptr_t>(lua_touserdata(L, 1));
+            c.bullet = c.manager.bullets.indexOf(BulletStore::Handle(handle));
+            c.first = 2;
+        }
+        else
+        {
+            c.bullet = c.manager.running();
+        }
+
+        return c;
+    }
+
+    static BulletStore& store(Call& c)
+    {
+        return c.manager.bullets;
+    }
+
+    // Id of the function at `index` in the ScriptTable, as a function of bullet `i`'s state.
+    // nullfunc has none, since there is nothing to run.
+    static ScriptTable::Id toFunction(Call& c, unsigned int i, int index)
+    {
+        luaL_checktype(c.L, index, LUA_TFUNCTION);
+
+        ScriptTable::Id state = store(c).scripts[i].state;
+        if (lua_tocfunction(c.L, index) == &nullfunc || state == ScriptTable::NONE)
+            return ScriptTable::NONE;
+
+        return c.manager.scriptTable.function(state, c.L, index);
+    }
+
+    // Spawn `count` children of the call's bullet running the function (or behavior) at stack
+    // index `funcArg`, spaced `dStep` radians and `sStep` speed apart. They all share one
+    // function id.
+    static void spawn(Call& c, int funcArg, unsigned int count,
+                      float d, float dStep, float s, float sStep)
+    {
+        // Children leave from the parent's center, whatever the size of either.
+        BulletStore& bullets = store(c);
+        float cx = bullets.x[c.bullet] + bullets.w[c.bullet] / 2;
+        float cy = bullets.y[c.bullet] + bullets.h[c.bullet] / 2;
+        BulletLuaManager::Spawn spawn{cx, cy, d, dStep, s, sStep,
+                                      count, bullets.scripts[c.bullet].state, ScriptTable::NONE,
+                                      0, bullets.layer[c.bullet],
+                                      BulletStore::DEFAULT_SIZE, BulletStore::DEFAULT_SIZE, 0.0f,
+                                      255, 255, 255};
+
+        void* behavior = luaL_testudata(c.L, funcArg, BEHAVIOR);
+        if (behavior != nullptr)
+        {
+            if (count == 0)
+                return;
+
+            // The spawn holds its bullets' users until they exist.
+            spawn.behavior = c.manager.internBehavior(*static_cast<Behavior*>(behavior), count);
+            if (spawn.behavior == 0)
+                luaL_error(c.L, "too many distinct behaviors");
+        }
+        else
+        {
+            // Children that only fly (nullfunc) never need a lua call.
+            luaL_checktype(c.L, funcArg, LUA_TFUNCTION);
+            if (count == 0)
+                return;
+
+            spawn.function = toFunction(c, c.bullet, funcArg);
+        }
+
+        c.manager.fire(spawn);
+    }
+
+    static void spawn(Call& c, int funcArg, float d, float s)
+    {
+        spawn(c, funcArg, 1, d, 0.0f, s, 0.0f);
+    }
+
+    // Spawn `count` children fanned evenly over `spread` radians around direction `d`.
+    static void spawnSpread(Call& c, int funcArg, lua_Integer count, float d, float spread,
+                            float s)
+    {
+        if (count < 1)
+            return;
+
+        float step = count > 1 ? spread / (count - 1) : 0.0f;
+        float start = count > 1 ? d - spread / 2 : d;
+        spawn(c, funcArg, count, start, step, s, 0.0f);
+    }
+
+    // Park the running bullet's coroutine for `frames` ticks. Sleeping always applies to the
+    // running bullet, since that's whose coroutine yields.
+    static int sleep(Call& c, lua_Integer frames)
+    {
+        BulletStore::Script& script = store(c).scripts[c.manager.running()];
+        script.wake = c.manager.frame + (frames < 1 ? 1 : frames);
+
+        return lua_yield(c.L, 0);
+    }
+
+    static int nullfunc(lua_State*)
+    {
+        return 0;
+    }
+
+    static int getPosition(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushnumber(L, store(c).x[c.bullet]);
+        lua_pushnumber(L, store(c).y[c.bullet]);
+        return 2;
+    }
+
+    static int getTargetPosition(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushnumber(L, c.manager.player.x);
+        lua_pushnumber(L, c.manager.player.y);
+        return 2;
+    }
+
+    static int getNearestTargetPosition(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        const BulletLuaUtils::Rect& target = c.manager.nearestTarget(c.bullet);
+        lua_pushnumber(L, target.x);
+        lua_pushnumber(L, target.y);
+        return 2;
+    }
+
+    static int setLayer(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer layer = c.integer(0);
+
+        if (c.valid() && layer >= 0 && layer < LAYER_COUNT)
+            store(c).layer[c.bullet] = layer;
+
+        return 0;
+    }
+
+    static int getLayer(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushinteger(L, store(c).layer[c.bullet]);
+        return 1;
+    }
+
+    static int getVelocity(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushnumber(L, store(c).vx[c.bullet]);
+        lua_pushnumber(L, store(c).vy[c.bullet]);
+        return 2;
+    }
+
+    static int getSpeed(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushnumber(L, store(c).getSpeed(c.bullet));
+        return 1;
+    }
+
+    static int getDirection(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushnumber(L, Math::radToDeg(store(c).getDirection(c.bullet)));
+        return 1;
+    }
+
+    static int setCollision(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        if (lua_toboolean(L, c.first))
+            store(c).flags[c.bullet] |= BulletStore::Collision;
+        else
+            store(c).flags[c.bullet] &= ~BulletStore::Collision;
+
+        return 0;
+    }
+
+    static int setHitbox(lua_State* L)
+    {
+        Call c = begin(L);
+        float w = c.number(0);
+        float h = c.number(1);
+
+        if (c.valid())
+            store(c).setHitbox(c.bullet, w, h);
+
+        return 0;
+    }
+
+    static int setRadius(lua_State* L)
+    {
+        Call c = begin(L);
+        float r = c.number(0);
+
+        if (c.valid())
+            store(c).setRadius(c.bullet, r);
+
+        return 0;
+    }
+
+    static int getLife(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushinteger(L, store(c).life[c.bullet]);
+        return 1;
+    }
+
+    static int getTurn(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushinteger(L, store(c).turn[c.bullet]);
+        return 1;
+    }
+
+    static int resetTurns(lua_State* L)
+    {
+        Call c = begin(L);
+        if (c.valid())
+            store(c).turn[c.bullet] = 0;
+
+        return 0;
+    }
+
+    static int getRank(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushnumber(L, c.manager.rank);
+        return 1;
+    }
+
+    static int randFloat(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushnumber(L, c.manager.randomFloat(0.0f, 1.0f));
+        return 1;
+    }
+
+    static int randFloatRange(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushnumber(L, c.manager.randomFloat(c.number(0), c.number(1)));
+        return 1;
+    }
+
+    static int randInt(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushinteger(L, c.manager.randomInt(0, c.integer(0)));
+        return 1;
+    }
+
+    static int randIntRange(lua_State* L)
+    {
+        Call c = begin(L);
+
+        lua_pushinteger(L, c.manager.randomInt(c.integer(0), c.integer(1)));
+        return 1;
+    }
+
+    static int setPosition(lua_State* L)
+    {
+        Call c = begin(L);
+        float x = c.number(0);
+        float y = c.number(1);
+
+        if (c.valid())
+            store(c).setCenter(c.bullet, x, y);
+
+        return 0;
+    }
+
+    static int setVelocity(lua_State* L)
+    {
+        Call c = begin(L);
+        float vx = c.number(0);
+        float vy = c.number(1);
+
+        if (c.valid())
+        {
+            store(c).vx[c.bullet] = vx;
+            store(c).vy[c.bullet] = vy;
+        }
+
+        return 0;
+    }
+
+    static int setDirection(lua_State* L)
+    {
+        Call c = begin(L);
+        float dir = c.number(0);
+
+        if (c.valid())
+            store(c).setDirection(c.bullet, Math::degToRad(dir));
+
+        return 0;
+    }
+
+    static int setDirectionRelative(lua_State* L)
+    {
+        Call c = begin(L);
+        float dir = c.number(0);
+
+        if (c.valid())
+            store(c).setDirectionRelative(c.bullet, Math::degToRad(dir));
+
+        return 0;
+    }
+
+    static int aimTarget(lua_State* L)
+    {
+        Call c = begin(L);
+
+        if (c.valid())
+            store(c).aimAtPoint(c.bullet, c.manager.player.x, c.manager.player.y);
+
+        return 0;
+    }
+
+    static int aimNearestTarget(lua_State* L)
+    {
+        Call c = begin(L);
+
+        if (c.valid())
+        {
+            const BulletLuaUtils::Rect& target = c.manager.nearestTarget(c.bullet);
+            store(c).aimAtPoint(c.bullet, target.x, target.y);
+        }
+
+        return 0;
+    }
+
+    static int aimPoint(lua_State* L)
+    {
+        Call c = begin(L);
+        float x = c.number(0);
+        float y = c.number(1);
+
+        if (c.valid())
+            store(c).aimAtPoint(c.bullet, x, y);
+
+        return 0;
+    }
+
+    static int setSpeed(lua_State* L)
+    {
+        Call c = begin(L);
+        float s = c.number(0);
+
+        if (c.valid())
+            store(c).setSpeed(c.bullet, s);
+
+        return 0;
+    }
+
+    static int setSpeedRelative(lua_State* L)
+    {
+        Call c = begin(L);
+        float s = c.number(0);
+
+        if (c.valid())
+            store(c).setSpeedRelative(c.bullet, s);
+
+        return 0;
+    }
+
+    static int linearInterpolate(lua_State* L)
+    {
+        Call c = begin(L);
+        float x = c.number(0);
+        float y = c.number(1);
+        float steps = c.number(2);
+
+        if (c.valid())
+        {
+            store(c).vx[c.bullet] = (x - store(c).x[c.bullet]) / steps;
+            store(c).vy[c.bullet] = (y - store(c).y[c.bullet]) / steps;
+        }
+
+        return 0;
+    }
+
+    static int setFunction(lua_State* L)
+    {
+        Call c = begin(L);
+        luaL_checktype(L, c.first, LUA_TFUNCTION);
+
+        if (c.valid())
+        {
+            ScriptTable::Id function = toFunction(c, c.bullet, c.first);
+            BulletStore::Script& script = store(c).scripts[c.bullet];
+
+            store(c).turn[c.bullet] = 0;
+            c.manager.retainFunction(function);
+            c.manager.releaseFunction(script.function);
+            script.function = function;
+
+            // No function means there's nothing left to run.
+            if (function == ScriptTable::NONE)
+                script.wake = BulletStore::Script::NEVER;
+            else if (script.wake == BulletStore::Script::NEVER)
+                c.manager.wakeUp(c.bullet);
+        }
+
+        return 0;
+    }
+
+    static int setBehavior(lua_State* L)
+    {
+        Call c = begin(L);
+
+        Behavior* behavior = nullptr;
+        if (!lua_isnoneornil(L, c.first))
+            behavior = static_cast<Behavior*>(luaL_checkudata(L, c.first, BEHAVIOR));
+
+        if (!c.valid())
+            return 0;
+
+        unsigned short id = 0;
+        if (behavior != nullptr)
+        {
+            id = c.manager.internBehavior(*behavior, 1);
+            if (id == 0)
+                return luaL_error(L, "too many distinct behaviors");
+        }
+
+        unsigned short& current = store(c).behavior[c.bullet];
+        c.manager.releaseBehavior(current);
+        current = id;
+
+        return 0;
+    }
+
+    // Behavior.turn{...} and friends. The upvalue is the BehaviorKind.
+    static int newBehavior(lua_State* L)
+    {
+        int kind = lua_tointeger(L, lua_upvalueindex(1));
+
+        luaL_checktype(L, 1, LUA_TTABLE);
+
+        Behavior behavior;
+        float rate = Math::degToRad(field(L, "rate", 0.0f));
+
+        switch (kind)
+        {
+            case TURN:
+                behavior.turn = rate;
+                break;
+            case HOMING:
+                behavior.homing = rate;
+                break;
+            case ORBIT:
+                behavior.orbit = rate;
+                behavior.orbitX = field(L, "x", 0.0f);
+                behavior.orbitY = field(L, "y", 0.0f);
+                break;
+            default:
+                break;
+        }
+
+        behavior.accel = field(L, "accel", 0.0f);
+        behavior.minSpeed = field(L, "minSpeed", 0.0f);
+        behavior.maxSpeed = field(L, "maxSpeed", FLT_MAX);
+
+        // Frames to live, or 0 for no limit. Huge lifetimes are as good as none.
+        float life = field(L, "life", 0.0f);
+        if (!(life >= 0.0f) || std::isinf(life))
+            return luaL_argerror(L, 1, "life must be a finite, non-negative number of frames");
+
+        behavior.life = life >= float(UINT_MAX) ? UINT_MAX : (unsigned int)life;
+        behavior.amplitude = Math::degToRad(field(L, "amplitude", 0.0f));
+        behavior.period = field(L, "period", 0.0f);
+
+        // Behavior has nothing to destroy, so no __gc is needed.
+        new (lua_newuserdata(L, sizeof(Behavior))) Behavior(behavior);
+        luaL_setmetatable(L, BEHAVIOR);
+
+        return 1;
+    }
+
+    static int stop(lua_State* L)
+    {
+        Call c = begin(L);
+        if (c.valid())
+            store(c).scripts[c.bullet].wake = BulletStore::Script::NEVER;
+
+        return 0;
+    }
+
+    static int wait(lua_State* L)
+    {
+        Call c = begin(L);
+        return sleep(c, c.integer(0));
+    }
+
+    static int waitUntil(lua_State* L)
+    {
+        Call c = begin(L);
+        return sleep(c, c.integer(0) - store(c).turn[c.manager.running()]);
+    }
+
+    static int fire(lua_State* L)
+    {
+        Call c = begin(L);
+        float d = c.number(0);
+        float s = c.number(1);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+            spawn(c, c.first + 2, Math::degToRad(d), s);
+
+        return 0;
+    }
+
+    static int fireAtTarget(lua_State* L)
+    {
+        Call c = begin(L);
+        float s = c.number(0);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+        {
+            const BulletLuaUtils::Rect& player = c.manager.player;
+            spawn(c, c.first + 1, store(c).getAimDirection(c.bullet, player.x, player.y), s);
+        }
+
+        return 0;
+    }
+
+    static int fireAtNearestTarget(lua_State* L)
+    {
+        Call c = begin(L);
+        float s = c.number(0);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+        {
+            const BulletLuaUtils::Rect& target = c.manager.nearestTarget(c.bullet);
+            spawn(c, c.first + 1, store(c).getAimDirection(c.bullet, target.x, target.y), s);
+        }
+
+        return 0;
+    }
+
+    static int fireCircle(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer segments = c.integer(0);
+        float s = c.number(1);
+
+        if (c.valid() && !store(c).isDying(c.bullet) && segments > 0)
+        {
+            spawn(c, c.first + 2, segments, 0.0f, Math::PI * 2 / segments, s, 0.0f);
+        }
+
+        return 0;
+    }
+
+    static int fireSpread(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer count = c.integer(0);
+        float d = c.number(1);
+        float spread = c.number(2);
+        float s = c.number(3);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+        {
+            spawnSpread(c, c.first + 4, count, Math::degToRad(d), Math::degToRad(spread), s);
+        }
+
+        return 0;
+    }
+
+    static int fireArc(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer count = c.integer(0);
+        float from = c.number(1);
+        float to = c.number(2);
+        float s = c.number(3);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+        {
+            spawnSpread(c, c.first + 4, count, Math::degToRad((from + to) / 2),
+                        Math::degToRad(to - from), s);
+        }
+
+        return 0;
+    }
+
+    static int fireSpreadAtTarget(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer count = c.integer(0);
+        float spread = c.number(1);
+        float s = c.number(2);
+
+        if (c.valid() && !store(c).isDying(c.bullet))
+        {
+            const BulletLuaUtils::Rect& player = c.manager.player;
+            spawnSpread(c, c.first + 3, count,
+                        store(c).getAimDirection(c.bullet, player.x, player.y),
+                        Math::degToRad(spread), s);
+        }
+
+        return 0;
+    }
+
+    static int fireStack(lua_State* L)
+    {
+        Call c = begin(L);
+        lua_Integer count = c.integer(0);
+        float d = c.number(1);
+        float s = c.number(2);
+        float step = c.number(3);
+
+        if (c.valid() && !store(c).isDying(c.bullet) && count > 0)
+        {
+            spawn(c, c.first + 4, count, Math::degToRad(d), 0.0f, s, step);
+        }
+
+        return 0;
+    }
+
+    static int setColor(lua_State* L)
+    {
+        Call c = begin(L);
+        unsigned char r = c.integer(0);
+        unsigned char g = c.integer(1);
+        unsigned char b = c.integer(2);
+
+        if (c.valid())
+            store(c).setColor(c.bullet, r, g, b);
+
+        return 0;
+    }
+
+    static int getColor(lua_State* L)
+    {
+        Call c = begin(L);
+        if (!c.valid())
+            return 0;
+
+        lua_pushinteger(L, store(c).r[c.bullet]);
+        lua_pushinteger(L, store(c).g[c.bullet]);
+        lua_pushinteger(L, store(c).b[c.bullet]);
+        return 3;
+    }
+
+    static int vanish(lua_State* L)
+    {
+        Call c = begin(L);
+        if (c.valid())
+            store(c).vanish(c.bullet);
+
+        return 0;
+    }
+
+    static int kill(lua_State* L)
+    {
+        Call c = begin(L);
+        if (c.valid())
+            store(c).kill(c.bullet);
+
+        return 0;
+    }
+};
+
+void BulletLuaApi::open(lua_State* L, BulletLuaManager* manager)
+{
+    static const luaL_Reg functions[] =
+    {
+        {"nullfunc",                &Functions::nullfunc},
+        {"getPosition",             &Functions::getPosition},
+        {"getTargetPosition",       &Functions::getTargetPosition},
+        {"getNearestTargetPosition",&Functions::getNearestTargetPosition},
+        {"setLayer",                &Functions::setLayer},
+        {"getLayer",                &Functions::getLayer},
+        {"getVelocity",             &Functions::getVelocity},
+        {"getSpeed",                &Functions::getSpeed},
+        {"getDirection",            &Functions::getDirection},
+        {"setCollision",            &Functions::setCollision},
+        {"setHitbox",               &Functions::setHitbox},
+        {"setRadius",               &Functions::setRadius},
+        {"getLife",                 &Functions::getLife},
+        {"getTurn",                 &Functions::getTurn},
+        {"resetTurns",              &Functions::resetTurns},
+        {"getRank",                 &Functions::getRank},
+        {"randFloat",               &Functions::randFloat},
+        {"randFloatRange",          &Functions::randFloatRange},
+        {"randInt",                 &Functions::randInt},
+        {"randIntRange",            &Functions::randIntRange},
+        {"setPosition",             &Functions::setPosition},
+        {"setVelocity",             &Functions::setVelocity},
+        {"setDirection",            &Functions::setDirection},
+        {"setDirectionRelative",    &Functions::setDirectionRelative},
+        {"aimTarget",               &Functions::aimTarget},
+        {"aimNearestTarget",        &Functions::aimNearestTarget},
+        {"aimPoint",                &Functions::aimPoint},
+        {"setSpeed",                &Functions::setSpeed},
+        {"setSpeedRelative",        &Functions::setSpeedRelative},
+        {"linearInterpolate",       &Functions::linearInterpolate},
+        {"setFunction",             &Functions::setFunction},
+        {"stop",                    &Functions::stop},
+        {"setBehavior",             &Functions::setBehavior},
+        {"wait",                    &Functions::wait},
+        {"waitUntil",               &Functions::waitUntil},
+        {"fire",                    &Functions::fire},
+        {"fireAtTarget",            &Functions::fireAtTarget},
+        {"fireAtNearestTarget",     &Functions::fireAtNearestTarget},
+        {"fireCircle",              &Functions::fireCircle},
+        {"fireSpread",              &Functions::fireSpread},
+        {"fireArc",                 &Functions::fireArc},
+        {"fireSpreadAtTarget",      &Functions::fireSpreadAtTarget},
+        {"fireStack",               &Functions::fireStack},
+        {"setColor",                &Functions::setColor},
+        {"getColor",                &Functions::getColor},
+        {"vanish",                  &Functions::vanish},
+        {"kill",                    &Functions::kill},
+        {nullptr, nullptr}
+    };
+
+    // One table holds the whole API. It is the method table of bullet objects and the fallback
+    // for globals, so each function is created once per state instead of once per use.
+    lua_createtable(L, 0, sizeof(functions) / sizeof(functions[0]) + LAYER_COUNT - 1);
+    lua_pushlightuserdata(L, manager);
+    luaL_setfuncs(L, functions, 1);
+
+    lua_pushinteger(L, ENEMY_BULLETS);
+    lua_setfield(L, -2, "ENEMY_BULLETS");
+    lua_pushinteger(L, PLAYER_BULLETS);
+    lua_setfield(L, -2, "PLAYER_BULLETS");
+    lua_pushinteger(L, HAZARDS);
+    lua_setfield(L, -2, "HAZARDS");
+
+    static const char* const behaviors[] = {"turn", "accelerate", "homing", "wave", "orbit"};
+
+    luaL_newmetatable(L, BEHAVIOR);
+    lua_pop(L, 1);
+
+    lua_createtable(L, 0, sizeof(behaviors) / sizeof(behaviors[0]));
+    for (int kind = TURN; kind <= ORBIT; ++kind)
+    {
+        lua_pushinteger(L, kind);
+        lua_pushcclosure(L, &Functions::newBehavior, 1);
+        lua_setfield(L, -2, behaviors[kind]);
+    }
+    lua_setfield(L, -2, "Behavior");
+
+    // Globals scripts define themselves still shadow the API.
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, -3);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+
+    // Light userdata all share one metatable, so this applies to every bullet object.
+    lua_pushlightuserdata(L, nullptr);
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, -3);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    lua_pop(L, 2);
+}
+
+void BulletLuaApi::pushBullet(lua_State* L, BulletStore::Handle handle)
+{
+    lua_pushlightuserdata(L, reinterpret_cast<void*>(std::uintptr_t(handle)));
+}
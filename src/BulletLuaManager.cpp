@@ -1,137 +1,439 @@
 #include <bulletlua/BulletLuaManager.hpp>
-#include <bulletlua/BulletLua.hpp>
+#include <bulletlua/BulletLuaApi.hpp>
+#include <bulletlua/ChunkCache.hpp>
+#include <bulletlua/Bullet.hpp>
 
 #include <bulletlua/Utils/Rng.hpp>
 #include <bulletlua/Utils/Math.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+    // Whether both stores hold the same bullets, in any order, to within `tolerance`.
+    bool sameBullets(const BulletStore& a, const BulletStore& b, float tolerance)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        std::vector<std::pair<float, float>> pa;
+        std::vector<std::pair<float, float>> pb;
+        for (unsigned int i = 0; i < a.size(); ++i)
+        {
+            pa.emplace_back(a.x[i], a.y[i]);
+            pb.emplace_back(b.x[i], b.y[i]);
+        }
+
+        std::sort(pa.begin(), pa.end());
+        std::sort(pb.begin(), pb.end());
+
+        for (unsigned int i = 0; i < pa.size(); ++i)
+        {
+            if (std::abs(pa[i].first - pb[i].first) > tolerance ||
+                std::abs(pa[i].second - pb[i].second) > tolerance)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Marks state ids that have no group yet in BulletLuaManager::groupOf.
+    const unsigned int NO_GROUP = 0xFFFFFFFF;
+
+    // Registry key of each state's idle coroutines.
+    const char threadsKey = 0;
+
+    // Push an idle coroutine of `L` (or a new one) and return it.
+    lua_State* takeThread(lua_State* L)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &threadsKey);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &threadsKey);
+        }
+
+        int count = lua_rawlen(L, -1);
+        if (count == 0)
+        {
+            lua_pop(L, 1);
+            return lua_newthread(L);
+        }
+
+        lua_rawgeti(L, -1, count);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, count);
+        lua_remove(L, -2);
+
+        return lua_tothread(L, -1);
+    }
+
+    // Make the finished coroutine at `index` idle again.
+    void giveThread(lua_State* L, int index)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &threadsKey);
+        lua_pushvalue(L, index);
+        lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+        lua_pop(L, 1);
+    }
+}
+
+thread_local BulletLuaManager::Lane* BulletLuaManager::lane = nullptr;
+
 BulletLuaManager::BulletLuaManager(int left, int top, int width, int height, const BulletLuaUtils::Rect& playerp)
-    : current{nullptr},
+    : current{0},
       // player{playerp},
       player(playerp),
       rank{0.8},
-      collision{BulletLuaUtils::Rect{float(left), float(top), float(width), float(height)}},
-      rng{}
+      frame{0},
+      timing{SAME_FRAME},
+      spawns{},
+      pool{nullptr},
+      groups{},
+      lanes{},
+      groupOf{},
+      behaviorLock{},
+      states{[this](sol::state& luaState) { initLua(luaState); }},
+      scriptTable{},
+      bullets{},
+      behaviors(1),
+      behaviorUsers(1, 0),
+      freeBehaviors{},
+      behaviorIds{},
+      behaviorEnd{},
+      behaviorOrder{},
+      targetX{},
+      targetY{},
+      blocks{0},
+      layers{},
+      rng{},
+      snapshotBuffer{},
+      publishing{false}
 
 {
+    targets.push_back(Target{&player, ENEMY_BULLETS});
+
+    BulletLuaUtils::Rect area{float(left), float(top), float(width), float(height)};
+    for (unsigned int layer = 0; layer < LAYER_COUNT; ++layer)
+    {
+        layers.emplace_back(new SpacialPartition{bullets, area, CollisionLayer(layer)});
+    }
+
     // This only calls this class' version of this function, not any subclass'.
     increaseCapacity();
 }
 
 BulletLuaManager::~BulletLuaManager()
 {
-    for (auto iter = blocks.begin(); iter != blocks.end(); ++iter)
+    for (unsigned int i = 0; i < bullets.size(); ++i)
     {
-        delete [] *iter;
+        releaseScript(i);
     }
 }
 
 // Create a root bullet from an external script.
-void BulletLuaManager::createBulletFromFile(const std::string& filename,
+BulletStore::Handle BulletLuaManager::createBulletFromFile(const std::string& filename,
                                             Bullet* origin)
 {
-    BulletLua* b = getFreeBullet();
-
-    std::shared_ptr<sol::state> luaState = initLua();
-    luaState->open_file(filename);
+    std::shared_ptr<sol::state> luaState = states.acquire();
+    runChunk(*luaState, ChunkCache::instance().loadFile(luaState->lua_state(), filename));
 
-    b->set(luaState,
-           luaState->get<sol::function>("main"),
-           origin);
-
-    bullets.push_back(b);
+    return startRoot(std::move(luaState), origin);
 }
 
 // Create a root bullet from an embedded script.
-void BulletLuaManager::createBulletFromScript(const std::string& script,
+BulletStore::Handle BulletLuaManager::createBulletFromScript(const std::string& script,
                                               Bullet* origin)
 {
-    BulletLua* b = getFreeBullet();
-
-    std::shared_ptr<sol::state> luaState = initLua();
-    luaState->script(script);
-
-    b->set(luaState,
-           luaState->get<sol::function>("main"),
-           origin);
+    std::shared_ptr<sol::state> luaState = states.acquire();
+    runChunk(*luaState, ChunkCache::instance().loadScript(luaState->lua_state(), script));
 
-    bullets.push_back(b);
+    return startRoot(std::move(luaState), origin);
 }
 
-// // Create Child Bullet
-// void BulletLuaManager::createBullet(std::shared_ptr<sol::state> lua,
-//                   const sol::function& func,
-//                   Bullet* origin)
-// {
-//     BulletLua* b = getFreeBullet();
-//     b->set(lua, func, origin, this);
-//     bullets.push_back(b);
-// }
-
 // Create Child Bullet
-void BulletLuaManager::createBullet(std::shared_ptr<sol::state> lua,
+unsigned int BulletLuaManager::createBullet(std::shared_ptr<sol::state> lua,
                                     const sol::function& func,
                                     float x, float y, float d, float s)
 {
-    BulletLua* b = getFreeBullet();
-    b->set(lua, func, x, y, d, s);
-    bullets.push_back(b);
+    lua_State* L = func.state();
+    func.push();
+    ScriptTable::Id state = scriptTable.state(std::move(lua));
+    ScriptTable::Id function = scriptTable.function(state, L, -1);
+    lua_pop(L, 1);
+
+    unsigned int i = getFreeBullet();
+    bullets.x[i] = x;
+    bullets.y[i] = y;
+    bullets.setSpeedAndDirection(i, s, d);
+    start(i, state, function);
+
+    return i;
 }
 
 bool BulletLuaManager::checkCollision()
 {
-    return collision.checkCollision(player);
+    return layers[ENEMY_BULLETS]->checkCollision(player);
 }
 
-void BulletLuaManager::tick()
+bool BulletLuaManager::checkCollision(float cx, float cy, float radius)
 {
-    // Reset containers inside collision detection object.
-    // Since bullets are dynamic and are most likely unpredictable,
-    // we must repopulate the containers each frame.
-    collision.reset();
+    return layers[ENEMY_BULLETS]->checkCollision(cx, cy, radius);
+}
+
+CollisionResult BulletLuaManager::queryCollision(float grazeRadius,
+                                                 BulletStore::Handle* hits, unsigned int capacity)
+{
+    return layers[ENEMY_BULLETS]->query(player, grazeRadius, hits, capacity);
+}
+
+unsigned int BulletLuaManager::addTarget(const BulletLuaUtils::Rect& target, CollisionLayer hitBy)
+{
+    targets.push_back(Target{&target, hitBy});
+    return targets.size() - 1;
+}
 
-    for (auto iter = bullets.begin(); iter != bullets.end();)
+void BulletLuaManager::clearTargets()
+{
+    targets.resize(1);
+}
+
+unsigned int BulletLuaManager::targetCount() const
+{
+    return targets.size();
+}
+
+void BulletLuaManager::checkCollisions(bool* results) const
+{
+    for (unsigned int t = 0; t < targets.size(); ++t)
     {
-        // Must be set so lua knows which bullet to modify.
-        current = *iter;
+        results[t] = layers[targets[t].hitBy]->checkCollision(*targets[t].rect);
+    }
+}
 
-        (*iter)->run(collision);
+void BulletLuaManager::queryCollisions(float grazeRadius, CollisionResult* results) const
+{
+    for (unsigned int t = 0; t < targets.size(); ++t)
+    {
+        results[t] = layers[targets[t].hitBy]->query(*targets[t].rect, grazeRadius, nullptr, 0);
+    }
+}
 
-        // If the current bullet is dead, push it onto the free stack.
-        // Keep in mind `erase` increments our iterator and returns a valid iterator.
-        if ((*iter)->isDead())
-        {
-            freeBullets.push(*iter);
-            iter = bullets.erase(iter);
-            continue;
-        }
+void BulletLuaManager::setSweptCollision(bool enabled)
+{
+    for (auto& layer : layers)
+    {
+        layer->setSweptCollision(enabled);
+    }
+}
+
+void BulletLuaManager::tick()
+{
+    // Script phase. Only bullets that are awake are visited: those that ran last frame and those
+    // whose wait ends now. Bullets fired meanwhile are added in bulk after each round of scripts.
+    sleepers.advance(active);
+
+    runScripts();
+
+    active.swap(next);
+    next.clear();
+
+    runBehaviors();
+
+    // Native phase: integrate, cull and fade everything in one sweep.
+    bullets.step(layers[0]->getArea());
 
-        if ((*iter)->collisionCheck)
+    if (!playbacks.empty())
+    {
+        std::function<unsigned int()> spawn = [this]() { return getFreeBullet(); };
+        for (PatternPlayer& playback : playbacks)
         {
-            collision.addBullet(*iter);
+            playback.advance(bullets, spawn);
         }
 
-        ++iter;
+        playbacks.erase(std::remove_if(playbacks.begin(), playbacks.end(),
+                                       [](const PatternPlayer& p) { return p.finished(); }),
+                        playbacks.end());
+    }
+
+    removeDead();
+    ++frame;
+
+    // Since bullets are dynamic and are most likely unpredictable,
+    // we must repopulate the collision grids each frame. Large grids are built on the pool.
+    // Each grid's tiles are sized for the bullets on its own layer.
+    unsigned int layerCounts[LAYER_COUNT] = {};
+    for (unsigned char l : bullets.layer)
+    {
+        ++layerCounts[l];
+    }
+
+    for (unsigned int l = 0; l < layers.size(); ++l)
+    {
+        layers[l]->tune(layerCounts[l]);
+        layers[l]->build();
+    }
+
+    if (publishing)
+    {
+        snapshotBuffer.back().capture(bullets, frame);
+        snapshotBuffer.publish();
     }
 }
 
-// Move all bullets to the free stack
+void BulletLuaManager::setSnapshots(bool enabled)
+{
+    publishing = enabled;
+}
+
+SnapshotBuffer& BulletLuaManager::snapshots()
+{
+    return snapshotBuffer;
+}
+
+// Record a pattern in a headless manager of its own.
+BakedPattern BulletLuaManager::bake(const Launcher& launch, unsigned int frames)
+{
+    const BulletLuaUtils::Rect& area = layers[0]->getArea();
+    BulletLuaManager recording{int(area.x), int(area.y), int(area.w), int(area.h), player};
+    recording.rank = rank;
+
+    launch(recording);
+
+    PatternRecorder recorder;
+    for (unsigned int f = 0; f < frames; ++f)
+    {
+        recording.tick();
+        recorder.capture(recording.bullets);
+    }
+
+    return recorder.finish();
+}
+
+void BulletLuaManager::play(std::shared_ptr<const BakedPattern> pattern)
+{
+    playbacks.emplace_back(std::move(pattern));
+}
+
+unsigned int BulletLuaManager::playingCount() const
+{
+    return playbacks.size();
+}
+
+// Run a pattern live and replayed side by side, and compare every frame.
+int BulletLuaManager::verifyBake(const Launcher& launch,
+                                 std::shared_ptr<const BakedPattern> pattern, float tolerance)
+{
+    const BulletLuaUtils::Rect& area = layers[0]->getArea();
+    BulletLuaManager live{int(area.x), int(area.y), int(area.w), int(area.h), player};
+    BulletLuaManager replay{int(area.x), int(area.y), int(area.w), int(area.h), player};
+    live.rank = rank;
+
+    launch(live);
+    replay.play(pattern);
+
+    for (unsigned int f = 0; f < pattern->frames; ++f)
+    {
+        live.tick();
+        replay.tick();
+
+        if (!sameBullets(live.bullets, replay.bullets, tolerance))
+            return f;
+    }
+
+    return -1;
+}
+
+void BulletLuaManager::setThreadPool(ThreadPool* threads)
+{
+    pool = threads;
+
+    for (auto& layer : layers)
+    {
+        layer->setThreadPool(threads);
+    }
+}
+
+void BulletLuaManager::setSpawnTiming(SpawnTiming spawnTiming)
+{
+    timing = spawnTiming;
+}
+
+void BulletLuaManager::seed(std::uint_fast64_t value)
+{
+    rng.engine.seed(value);
+}
+
+// Remove all bullets.
 void BulletLuaManager::clear()
 {
-    while (!bullets.empty())
+    for (const Spawn& spawn : spawns)
+    {
+        scriptTable.releaseFunction(spawn.function);
+        releaseBehavior(spawn.behavior, spawn.count);
+    }
+    spawns.clear();
+
+    for (unsigned int i = 0; i < bullets.size(); ++i)
+    {
+        releaseScript(i);
+        releaseBehavior(bullets.behavior[i]);
+    }
+
+    bullets.clear();
+
+    active.clear();
+    next.clear();
+    sleepers.clear();
+    playbacks.clear();
+
+    for (auto& layer : layers)
     {
-        freeBullets.push(bullets.front());
-        bullets.pop_front();
+        layer->reset();
     }
 }
 
 void BulletLuaManager::vanishAll()
 {
-    for (BulletLua* b : bullets)
+    for (unsigned int i = 0; i < bullets.size(); ++i)
     {
-        b->vanish();
+        bullets.vanish(i);
     }
 }
 
+bool BulletLuaManager::isAlive(BulletStore::Handle handle) const
+{
+    return bullets.isValid(handle);
+}
+
+void BulletLuaManager::vanish(BulletStore::Handle handle)
+{
+    unsigned int i = bullets.indexOf(handle);
+    if (i != BulletStore::INVALID_INDEX)
+        bullets.vanish(i);
+}
+
+void BulletLuaManager::kill(BulletStore::Handle handle)
+{
+    unsigned int i = bullets.indexOf(handle);
+    if (i != BulletStore::INVALID_INDEX)
+        bullets.kill(i);
+}
+
+void BulletLuaManager::prewarmStates(unsigned int count)
+{
+    states.prewarm(count);
+}
+
+unsigned int BulletLuaManager::idleStateCount() const
+{
+    return states.idleCount();
+}
+
 unsigned int BulletLuaManager::bulletCount() const
 {
     return bullets.size();
@@ -139,292 +441,627 @@ unsigned int BulletLuaManager::bulletCount() const
 
 unsigned int BulletLuaManager::freeCount() const
 {
-    return freeBullets.size();
+    return bullets.capacity() - bullets.size();
 }
 
 unsigned int BulletLuaManager::blockCount() const
 {
-    return blocks.size();
+    return blocks;
 }
 
-// Returns an unused bullet. Allocates more data blocks if there none are available
-BulletLua* BulletLuaManager::getFreeBullet()
+// Appends an unused bullet and returns its index.
+// Allocates more data blocks if there none are available.
+unsigned int BulletLuaManager::getFreeBullet()
 {
-    BulletLua* bullet = freeBullets.top();
-    freeBullets.pop();
+    unsigned int i = bullets.add(0.0f, 0.0f, 0.0f, 0.0f);
 
-    if (freeBullets.empty())
+    if (freeCount() == 0)
     {
         increaseCapacity();
     }
 
-    return bullet;
+    return i;
 }
 
 void BulletLuaManager::increaseCapacity(unsigned int blockSize)
 {
-    blocks.push_back(new BulletLua[blockSize]);
+    blocks += (blockSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-    // Throw all bullets into free stack
-    for (unsigned int i = 0; i < blockSize; ++i)
-    {
-        freeBullets.push(&blocks.back()[i]);
-    }
+    // Every array in the store (including the handle tables) is sized up front, so spawning
+    // and killing bullets never touches the heap until the next block is needed.
+    bullets.reserve(bullets.capacity() + blockSize);
+    active.reserve(bullets.capacity());
+    next.reserve(bullets.capacity());
 
     // Subclasses should override this method if their extensions depends on block size.
     // E.g. allocation of vertices or bookkeeping of vertices in a VBO.
     // Keep in mind that this original version will be called in the default constructor.
 }
 
-std::shared_ptr<sol::state> BulletLuaManager::initLua()
-{
-    std::shared_ptr<sol::state> luaState(new sol::state);
-
-    luaState->open_libraries(sol::lib::base);
-    luaState->open_libraries(sol::lib::math);
-    luaState->open_libraries(sol::lib::table);
-
-    luaState->set_function("nullfunc",
-                           [&]()
-                           {
-                           });
-
-    luaState->set_function("getPosition",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return std::make_tuple(c->position.x, c->position.y);
-                           });
-
-    luaState->set_function("getTargetPosition",
-                           [&]()
-                           {
-                               // BulletLua* c = this->current;
-                               return std::make_tuple(player.x, player.y);
-                           });
-
-    luaState->set_function("getVelocity",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return std::make_tuple(c->vx, c->vy);
-                           });
-
-    luaState->set_function("getSpeed",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return c->getSpeed();
-                           });
-
-    luaState->set_function("getDirection",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return Math::radToDeg(c->getDirection());
-                           });
-
-    luaState->set_function("setCollision",
-                           [&](bool collision)
-                           {
-                               BulletLua* c = this->current;
-                               c->collisionCheck = collision;
-                           });
-
-    luaState->set_function("getLife",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return c->life;
-                           });
-
-    luaState->set_function("getTurn",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return c->getTurn();
-                           });
-
-    luaState->set_function("resetTurns",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               c->turn = 0;
-                           });
-
-    luaState->set_function("getRank",
-                           [&]()
-                           {
-                               return BulletLuaManager::rank;
-                           });
-
-    luaState->set_function("randFloat",
-                           [&]()
-                           {
-                               return rng.float_01();
-                           });
-
-    luaState->set_function("randFloatRange",
-                           [&](float min, float max)
-                           {
-                               return rng.floatRange(min, max);
-                           });
-
-    luaState->set_function("randInt",
-                           [&](int max)
-                           {
-                               return rng.int_64(0, max);
-                           });
-
-    luaState->set_function("randIntRange",
-                           [&](int min, int max)
-                           {
-                               return rng.int_64(min, max);
-                           });
-
-    luaState->set_function("setPosition",
-                           [&](float x, float y)
-                           {
-                               BulletLua* c = this->current;
-                               c->setPosition(x, y);
-                           });
-
-    luaState->set_function("setVelocity",
-                           [&](float vx, float vy)
-                           {
-                               BulletLua* c = this->current;
-                               c->setVelocity(vx, vy);
-                           });
-
-    luaState->set_function("setDirection",
-                           [&](float dir)
-                           {
-                               BulletLua* c = this->current;
-                               c->setDirection(Math::degToRad(dir));
-                           });
-
-    luaState->set_function("setDirectionRelative",
-                           [&](float dir)
-                           {
-                               BulletLua* c = this->current;
-                               c->setDirectionRelative(Math::degToRad(dir));
-                           });
-
-    luaState->set_function("aimTarget",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               c->aimAtPoint(player.x, player.y);
-                           });
-
-    luaState->set_function("aimPoint",
-                           [&](float x, float y)
-                           {
-                               BulletLua* c = this->current;
-                               c->aimAtPoint(x, y);
-                           });
-
-    luaState->set_function("setSpeed",
-                           [&](float s)
-                           {
-                               BulletLua* c = this->current;
-                               c->setSpeed(s);
-                           });
-
-    luaState->set_function("setSpeedRelative",
-                           [&](float s)
-                           {
-                               BulletLua* c = this->current;
-                               c->setSpeedRelative(s);
-                           });
-
-    luaState->set_function("linearInterpolate",
-                           [&](float x, float y, unsigned int steps)
-                           {
-                               BulletLua* c = this->current;
-                               c->vx = (x - c->position.x) / steps;
-                               c->vy = (y - c->position.y) / steps;
-                           });
-
-    luaState->set_function("setFunction",
-                           [&](const sol::function& func)
-                           {
-                               BulletLua* c = this->current;
-                               c->setFunction(func);
-                           });
-
-    luaState->set_function("fire",
-                           [&](float d, float s,
-                               const sol::function& func)
-                           {
-                               BulletLua* c = this->current;
-                               if (c->dying)
-                                   return;
-
-                               this->createBullet(c->luaState, func,
-                                                  c->position.x, c->position.y,
-                                                  Math::degToRad(d), s);
-                           });
-
-    luaState->set_function("fireAtTarget",
-                           [&](float s,
-                               const sol::function& func)
-                           {
-                               BulletLua* c = this->current;
-                               if (c->dying)
-                                   return;
-
-                               this->createBullet(c->luaState, func,
-                                                  c->position.x, c->position.y,
-                                                  c->getAimDirection(player.x,
-                                                                     player.y),
-                                                  s);
-                           });
-
-    luaState->set_function("fireCircle",
-                           [&](int segments, float s,
-                               const sol::function& func)
-                           {
-                               BulletLua* c = this->current;
-                               if (c->dying)
-                                   return;
-
-                               float segRad = Math::PI * 2 / segments;
-                               for (int i = 0; i < segments; ++i)
-                               {
-                                   this->createBullet(c->luaState, func,
-                                                      c->position.x, c->position.y,
-                                                      segRad * i, s);
-                               }
-                           });
-
-    luaState->set_function("setColor",
-                           [&](unsigned char r, unsigned char g, unsigned char b)
-                           {
-                               BulletLua* c = this->current;
-                               c->setColor(r, g, b);
-                           });
-
-    luaState->set_function("getColor",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               return std::make_tuple(c->r, c->g, c->b);
-                           });
-
-    luaState->set_function("vanish",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               c->vanish();
-                           });
-
-    luaState->set_function("kill",
-                           [&]()
-                           {
-                               BulletLua* c = this->current;
-                               c->kill();
-                           });
-
-    return luaState;
+void BulletLuaManager::reserveFree(unsigned int count)
+{
+    // Keep at least one bullet free afterwards, like getFreeBullet does.
+    if (freeCount() > count)
+        return;
+
+    unsigned int missing = count + 1 - freeCount();
+    increaseCapacity((missing + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+}
+
+void BulletLuaManager::start(unsigned int i, ScriptTable::Id state, ScriptTable::Id function)
+{
+    scriptTable.retainState(state);
+    scriptTable.retainFunction(function);
+
+    bullets.scripts[i] = BulletStore::Script{state, function, nullptr, 0, 0, true};
+    active.push_back(bullets.handles[i]);
+}
+
+BulletStore::Handle BulletLuaManager::startRoot(std::shared_ptr<sol::state> luaState,
+                                                Bullet* origin)
+{
+    lua_State* L = luaState->lua_state();
+
+    // Check before interning the state, so a script without `main` doesn't leave it in the
+    // table. Unwinding hands it back to the pool.
+    lua_getglobal(L, "main");
+    if (!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        luaL_error(L, "script has no main function");
+    }
+
+    ScriptTable::Id state = scriptTable.state(std::move(luaState));
+    ScriptTable::Id main = scriptTable.function(state, L, -1);
+    lua_pop(L, 1);
+
+    unsigned int i = getFreeBullet();
+    bullets.set(i, *origin);
+    start(i, state, main);
+
+    return bullets.handles[i];
+}
+
+void BulletLuaManager::releaseScript(unsigned int i)
+{
+    BulletStore::Script& script = bullets.scripts[i];
+
+    if (script.thread != nullptr)
+    {
+        luaL_unref(scriptTable.luaState(script.state), LUA_REGISTRYINDEX, script.coroutine);
+        script.thread = nullptr;
+    }
+
+    scriptTable.releaseFunction(script.function);
+    scriptTable.releaseState(script.state);
+    script.function = ScriptTable::NONE;
+    script.state = ScriptTable::NONE;
+}
+
+void BulletLuaManager::removeDead()
+{
+    for (unsigned int i = 0; i < bullets.size(); ++i)
+    {
+        if (bullets.isDead(i))
+        {
+            releaseScript(i);
+            releaseBehavior(bullets.behavior[i]);
+        }
+    }
+
+    bullets.removeDead();
+}
+
+void BulletLuaManager::wakeUp(unsigned int i)
+{
+    BulletStore::Script& script = bullets.scripts[i];
+    if (script.queued)
+        return;
+
+    script.wake = 0;
+    script.queued = true;
+    (lane != nullptr ? lane->next : next).push_back(bullets.handles[i]);
+}
+
+unsigned int BulletLuaManager::running() const
+{
+    return lane != nullptr ? lane->current : current;
+}
+
+void BulletLuaManager::fire(const Spawn& spawn)
+{
+    retainFunction(spawn.function);
+    (lane != nullptr ? lane->spawns : spawns).push_back(spawn);
+}
+
+void BulletLuaManager::retainFunction(ScriptTable::Id function, unsigned int n)
+{
+    if (lane != nullptr)
+        lane->retained.emplace_back(function, n);
+    else
+        scriptTable.retainFunction(function, n);
+}
+
+void BulletLuaManager::releaseFunction(ScriptTable::Id function, unsigned int n)
+{
+    if (lane != nullptr)
+        lane->released.emplace_back(function, n);
+    else
+        scriptTable.releaseFunction(function, n);
+}
+
+void BulletLuaManager::commit(std::vector<Spawn>& buffer)
+{
+    unsigned int total = 0;
+    for (const Spawn& spawn : buffer)
+    {
+        total += spawn.count;
+    }
+
+    // Grow the store once for the whole buffer.
+    reserveFree(total);
+
+    for (const Spawn& spawn : buffer)
+    {
+        fireBatch(spawn);
+        scriptTable.releaseFunction(spawn.function);
+    }
+
+    buffer.clear();
+}
+
+float BulletLuaManager::randomFloat(float low, float high)
+{
+    if (lane != nullptr)
+        return lane->rng.floatRange(low, high);
+
+    return rng.floatRange(low, high);
+}
+
+long long BulletLuaManager::randomInt(long long low, long long high)
+{
+    if (lane != nullptr)
+        return lane->rng.int_64(low, high);
+
+    return rng.int_64(low, high);
+}
+
+void BulletLuaManager::runScript(BulletStore::Handle handle)
+{
+    unsigned int i = bullets.indexOf(handle);
+    if (i == BulletStore::INVALID_INDEX)
+        return;
+
+    BulletStore::Script& script = bullets.scripts[i];
+    script.queued = false;
+
+    run(i);
+
+    // Decide where the bullet goes next, unless its script already requeued it. Dead and
+    // stopped bullets drop out of scheduling; they still move in the native phase.
+    BulletStore::Script& after = bullets.scripts[i];
+    if (bullets.isDead(i) || after.queued || after.wake == BulletStore::Script::NEVER)
+        return;
+
+    after.queued = true;
+    if (after.wake > frame)
+    {
+        if (lane != nullptr)
+            lane->sleeping.emplace_back(handle, after.wake);
+        else
+            sleepers.schedule(handle, after.wake);
+    }
+    else
+    {
+        (lane != nullptr ? lane->next : next).push_back(handle);
+    }
+}
+
+void BulletLuaManager::runScripts()
+{
+    // With SAME_FRAME timing, bullets fired in a round are appended to `active` when it ends and
+    // run in the next one.
+    unsigned int begin = 0;
+    while (begin < active.size() || !spawns.empty())
+    {
+        unsigned int end = active.size();
+
+        if (pool != nullptr)
+        {
+            runRound(begin, end);
+        }
+        else
+        {
+            for (unsigned int n = begin; n < end; ++n)
+            {
+                runScript(active[n]);
+            }
+        }
+
+        commit(spawns);
+        begin = end;
+    }
+}
+
+void BulletLuaManager::runRound(unsigned int begin, unsigned int end)
+{
+    // Group by state, in order of first appearance.
+    unsigned int count = 0;
+    for (unsigned int n = begin; n < end; ++n)
+    {
+        unsigned int i = bullets.indexOf(active[n]);
+        if (i == BulletStore::INVALID_INDEX)
+            continue;
+
+        ScriptTable::Id state = bullets.scripts[i].state;
+        if (state >= groupOf.size())
+            groupOf.resize(state + 1, NO_GROUP);
+
+        if (groupOf[state] == NO_GROUP)
+        {
+            groupOf[state] = count++;
+            if (groups.size() < count)
+            {
+                groups.resize(count);
+                lanes.resize(count);
+            }
+        }
+
+        groups[groupOf[state]].push_back(active[n]);
+    }
+
+    for (unsigned int g = 0; g < count; ++g)
+    {
+        lanes[g].rng.seed(std::uint32_t(rng.bits_32()));
+    }
+
+    // Whatever the groups did before a script error still stands, as it does for serial scripts,
+    // so merge it either way. That also leaves the groups empty for the next round.
+    try
+    {
+        pool->run(count, [this](unsigned int g) { runGroup(g); });
+    }
+    catch (...)
+    {
+        mergeRound(count);
+        throw;
+    }
+
+    mergeRound(count);
+}
+
+void BulletLuaManager::mergeRound(unsigned int count)
+{
+    for (unsigned int g = 0; g < count; ++g)
+    {
+        Lane& done = lanes[g];
+
+        // Retains first, so nothing the lane still uses drops to zero users on the way.
+        for (const auto& retain : done.retained)
+        {
+            scriptTable.retainFunction(retain.first, retain.second);
+        }
+        for (const auto& release : done.released)
+        {
+            scriptTable.releaseFunction(release.first, release.second);
+        }
+
+        done.retained.clear();
+        done.released.clear();
+
+        commit(done.spawns);
+
+        next.insert(next.end(), done.next.begin(), done.next.end());
+        for (const auto& sleeper : done.sleeping)
+        {
+            sleepers.schedule(sleeper.first, sleeper.second);
+        }
+
+        done.next.clear();
+        done.sleeping.clear();
+
+        const BulletStore::Handle first = groups[g].front();
+        groupOf[bullets.scripts[bullets.indexOf(first)].state] = NO_GROUP;
+        groups[g].clear();
+    }
+}
+
+void BulletLuaManager::runGroup(unsigned int g)
+{
+    lane = &lanes[g];
+
+    try
+    {
+        for (BulletStore::Handle handle : groups[g])
+        {
+            runScript(handle);
+        }
+    }
+    catch (...)
+    {
+        lane = nullptr;
+        throw;
+    }
+
+    lane = nullptr;
+}
+
+unsigned short BulletLuaManager::internBehavior(const Behavior& behavior, unsigned int users)
+{
+    std::lock_guard<std::mutex> guard{behaviorLock};
+
+    auto found = behaviorIds.find(behavior);
+    if (found != behaviorIds.end())
+    {
+        behaviorUsers[found->second] += users;
+        return found->second;
+    }
+
+    unsigned short id;
+    if (!freeBehaviors.empty())
+    {
+        id = freeBehaviors.back();
+        freeBehaviors.pop_back();
+    }
+    else if (behaviors.size() <= 0xFFFF)
+    {
+        id = behaviors.size();
+        behaviors.emplace_back();
+        behaviorUsers.push_back(0);
+    }
+    else
+    {
+        return 0;
+    }
+
+    behaviors[id] = behavior;
+    behaviors[id].prepare();
+    behaviorUsers[id] = users;
+    behaviorIds.emplace(behavior, id);
+
+    return id;
+}
+
+void BulletLuaManager::releaseBehavior(unsigned short id, unsigned int n)
+{
+    if (id == 0)
+        return;
+
+    // Outside the script phase nothing else touches the table.
+    std::unique_lock<std::mutex> guard{behaviorLock, std::defer_lock};
+    if (lane != nullptr)
+        guard.lock();
+
+    behaviorUsers[id] -= n;
+    if (behaviorUsers[id] != 0)
+        return;
+
+    behaviorIds.erase(behaviors[id]);
+    freeBehaviors.push_back(id);
+}
+
+void BulletLuaManager::runBehaviors()
+{
+    // Bucket bullets by behavior with a counting sort. Id 0 counts nothing, so afterwards
+    // behaviorEnd[n - 1] is where the bullets of id n start.
+    behaviorEnd.assign(behaviors.size(), 0);
+
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < bullets.size(); ++i)
+    {
+        unsigned short id = bullets.behavior[i];
+        if (id != 0 && !bullets.isDead(i))
+        {
+            ++behaviorEnd[id];
+            ++total;
+        }
+    }
+
+    if (total == 0)
+        return;
+
+    unsigned int start = 0;
+    for (unsigned int& end : behaviorEnd)
+    {
+        unsigned int count = end;
+        end = start;
+        start += count;
+    }
+
+    behaviorOrder.resize(total);
+    for (unsigned int i = 0; i < bullets.size(); ++i)
+    {
+        unsigned short id = bullets.behavior[i];
+        if (id != 0 && !bullets.isDead(i))
+            behaviorOrder[behaviorEnd[id]++] = i;
+    }
+
+    for (unsigned int id = 1; id < behaviors.size(); ++id)
+    {
+        unsigned int begin = behaviorEnd[id - 1];
+        unsigned int count = behaviorEnd[id] - begin;
+        if (count == 0)
+            continue;
+
+        const Behavior& behavior = behaviors[id];
+        const unsigned int* indices = behaviorOrder.data() + begin;
+
+        if (behavior.homing != 0.0f)
+        {
+            targetX.resize(count);
+            targetY.resize(count);
+            for (unsigned int k = 0; k < count; ++k)
+            {
+                const BulletLuaUtils::Rect& target = nearestTarget(indices[k]);
+                targetX[k] = target.getCenterX();
+                targetY[k] = target.getCenterY();
+            }
+        }
+
+        behavior.apply(bullets, indices, count, targetX.data(), targetY.data());
+    }
+}
+
+unsigned int BulletLuaManager::fireBatch(const Spawn& spawn)
+{
+    reserveFree(spawn.count);
+
+    unsigned int first = bullets.addBatch(spawn.count, spawn.x - spawn.w / 2,
+                                          spawn.y - spawn.h / 2);
+    unsigned int end = first + spawn.count;
+
+    std::fill(bullets.w.begin() + first, bullets.w.end(), spawn.w);
+    std::fill(bullets.h.begin() + first, bullets.h.end(), spawn.h);
+    std::fill(bullets.radius.begin() + first, bullets.radius.end(), spawn.radius);
+    std::fill(bullets.layer.begin() + first, bullets.layer.end(), spawn.layer);
+    std::fill(bullets.behavior.begin() + first, bullets.behavior.end(), spawn.behavior);
+    std::fill(bullets.r.begin() + first, bullets.r.end(), spawn.r);
+    std::fill(bullets.g.begin() + first, bullets.g.end(), spawn.g);
+    std::fill(bullets.b.begin() + first, bullets.b.end(), spawn.b);
+
+    for (unsigned int i = first; i < end; ++i)
+    {
+        float k = float(i - first);
+        bullets.setSpeedAndDirection(i, spawn.s + k * spawn.sStep, spawn.d + k * spawn.dStep);
+    }
+
+    // The whole batch shares one state and one function, so it takes two counter bumps rather
+    // than a reference per bullet.
+    ScriptTable::Id state = spawn.state;
+    ScriptTable::Id function = spawn.function;
+    scriptTable.retainState(state, spawn.count);
+    scriptTable.retainFunction(function, spawn.count);
+
+    if (function == ScriptTable::NONE)
+    {
+        for (unsigned int i = first; i < end; ++i)
+        {
+            bullets.scripts[i] = BulletStore::Script{state, function, nullptr, 0,
+                                                     BulletStore::Script::NEVER, false};
+        }
+
+        return first;
+    }
+
+    std::vector<BulletStore::Handle>& queue = timing == SAME_FRAME ? active : next;
+    for (unsigned int i = first; i < end; ++i)
+    {
+        bullets.scripts[i] = BulletStore::Script{state, function, nullptr, 0, 0, true};
+        queue.push_back(bullets.handles[i]);
+    }
+
+    return first;
+}
+
+const BulletLuaUtils::Rect& BulletLuaManager::nearestTarget(unsigned int i) const
+{
+    const BulletLuaUtils::Rect* nearest = &player;
+    float best = -1.0f;
+
+    for (const Target& target : targets)
+    {
+        if (target.hitBy != bullets.layer[i])
+            continue;
+
+        float dx = target.rect->x - bullets.x[i];
+        float dy = target.rect->y - bullets.y[i];
+        float distance = dx * dx + dy * dy;
+
+        if (best < 0.0f || distance < best)
+        {
+            best = distance;
+            nearest = target.rect;
+        }
+    }
+
+    return *nearest;
+}
+
+void BulletLuaManager::run(unsigned int i)
+{
+    // Scripts written against the global API still act on the running bullet.
+    (lane != nullptr ? lane->current : current) = i;
+
+    // Sleeping bullets cost nothing but this check.
+    if (bullets.isDead(i) || bullets.scripts[i].wake > frame)
+        return;
+
+    // Scripts may spawn bullets and grow the store, so don't hold a reference into it across
+    // the call.
+    lua_State* L = scriptTable.luaState(bullets.scripts[i].state);
+    lua_State* thread = bullets.scripts[i].thread;
+    int top = lua_gettop(L);
+    int args = 0;
+
+    // Functions run as coroutines so they can wait(). The coroutine stays on L's stack while
+    // it runs, so the collector can't take it.
+    if (thread == nullptr)
+    {
+        thread = takeThread(L);
+
+        scriptTable.push(thread, bullets.scripts[i].function);
+        BulletLuaApi::pushBullet(thread, bullets.handles[i]);
+        args = 1;
+    }
+    else
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, bullets.scripts[i].coroutine);
+    }
+
+    int status = lua_resume(thread, L, args);
+    BulletStore::Script& script = bullets.scripts[i];
+
+    if (status == LUA_YIELD)
+    {
+        // Parked until script.wake, which wait() set.
+        lua_settop(thread, 0);
+
+        if (script.thread == nullptr)
+        {
+            script.thread = thread;
+            lua_pushvalue(L, -1);
+            script.coroutine = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+    }
+    else
+    {
+        if (script.thread != nullptr)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, script.coroutine);
+            script.thread = nullptr;
+        }
+
+        if (status != LUA_OK)
+        {
+            // Unprotected, like a plain call: errors go through sol's panic handler.
+            lua_xmove(thread, L, 1);
+            lua_error(L);
+        }
+
+        // Drop whatever the function returned, so the next resume starts on an empty stack.
+        lua_settop(thread, 0);
+        giveThread(L, -1);
+    }
+
+    lua_settop(L, top);
+}
+
+void BulletLuaManager::runChunk(sol::state& luaState, int loadStatus)
+{
+    lua_State* L = luaState.lua_state();
+
+    // Unprotected, like sol::state::script: errors go through sol's panic handler.
+    if (loadStatus != LUA_OK)
+        lua_error(L);
+
+    lua_call(L, 0, 0);
+}
+
+void BulletLuaManager::initLua(sol::state& luaState)
+{
+    luaState.open_libraries(sol::lib::base);
+    luaState.open_libraries(sol::lib::math);
+    luaState.open_libraries(sol::lib::table);
+
+    BulletLuaApi::open(luaState.lua_state(), this);
 }
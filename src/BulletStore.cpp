@@ -0,0 +1,507 @@
+#include <bulletlua/BulletStore.hpp>
+#include <bulletlua/Bullet.hpp>
+
+#include <bulletlua/Utils/Math.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Fade out over 30 frames
+    const int FADE_STEP = 255/30;
+}
+
+const BulletStore::Handle BulletStore::INVALID_HANDLE;
+const unsigned int BulletStore::INVALID_INDEX;
+constexpr float BulletStore::DEFAULT_SIZE;
+
+BulletStore::BulletStore()
+    : freeHead{0},
+      freeCount{0}
+{
+}
+
+unsigned int BulletStore::size() const
+{
+    return x.size();
+}
+
+unsigned int BulletStore::capacity() const
+{
+    return x.capacity();
+}
+
+bool BulletStore::empty() const
+{
+    return x.empty();
+}
+
+void BulletStore::reserve(unsigned int n)
+{
+    if (n <= x.capacity())
+        return;
+
+    x.reserve(n);
+    y.reserve(n);
+    w.reserve(n);
+    h.reserve(n);
+    radius.reserve(n);
+    vx.reserve(n);
+    vy.reserve(n);
+    life.reserve(n);
+    turn.reserve(n);
+    flags.reserve(n);
+    layer.reserve(n);
+    behavior.reserve(n);
+    r.reserve(n);
+    g.reserve(n);
+    b.reserve(n);
+    scripts.reserve(n);
+    handles.reserve(n);
+
+    // There can never be more slots than bullets, so this keeps add/remove allocation-free.
+    slotIndex.reserve(n);
+    slotGeneration.reserve(n);
+    freeSlots.reserve(n);
+}
+
+unsigned int BulletStore::indexOf(Handle handle) const
+{
+    std::uint32_t slot = handle & SLOT_MASK;
+
+    if (slot >= slotIndex.size() || slotGeneration[slot] != (handle >> SLOT_BITS))
+        return INVALID_INDEX;
+
+    return slotIndex[slot];
+}
+
+bool BulletStore::isValid(Handle handle) const
+{
+    return indexOf(handle) != INVALID_INDEX;
+}
+
+unsigned int BulletStore::slotCount() const
+{
+    return slotIndex.size();
+}
+
+unsigned int BulletStore::add(float nx, float ny, float nvx, float nvy)
+{
+    unsigned int i = size();
+
+    x.push_back(nx);
+    y.push_back(ny);
+    w.push_back(DEFAULT_SIZE);
+    h.push_back(DEFAULT_SIZE);
+    radius.push_back(0.0f);
+
+    Math::fixSpeed(nvy);
+    vx.push_back(nvx);
+    vy.push_back(nvy);
+
+    life.push_back(255);
+    turn.push_back(0);
+    flags.push_back(Collision);
+    layer.push_back(ENEMY_BULLETS);
+    behavior.push_back(0);
+
+    r.push_back(255);
+    g.push_back(255);
+    b.push_back(255);
+
+    scripts.push_back(Script{});
+    handles.push_back(acquireSlot(i));
+
+    return i;
+}
+
+unsigned int BulletStore::addBatch(unsigned int n, float nx, float ny)
+{
+    unsigned int first = size();
+    unsigned int end = first + n;
+
+    // Every field is filled with one resize, rather than `n` rounds of push_backs. vy gets the
+    // same nudge Math::fixSpeed gives a zero speed.
+    x.resize(end, nx);
+    y.resize(end, ny);
+    w.resize(end, DEFAULT_SIZE);
+    h.resize(end, DEFAULT_SIZE);
+    radius.resize(end, 0.0f);
+
+    vx.resize(end, 0.0f);
+    vy.resize(end, FLT_EPSILON);
+
+    life.resize(end, 255);
+    turn.resize(end, 0);
+    flags.resize(end, Collision);
+    layer.resize(end, ENEMY_BULLETS);
+    behavior.resize(end, 0);
+
+    r.resize(end, 255);
+    g.resize(end, 255);
+    b.resize(end, 255);
+
+    scripts.resize(end);
+
+    for (unsigned int i = first; i < end; ++i)
+    {
+        handles.push_back(acquireSlot(i));
+    }
+
+    return first;
+}
+
+void BulletStore::set(unsigned int i, const Bullet& origin)
+{
+    x[i]  = origin.position.x;
+    y[i]  = origin.position.y;
+    w[i]  = origin.position.w;
+    h[i]  = origin.position.h;
+    radius[i] = 0.0f;
+    vx[i] = origin.vx;
+    vy[i] = origin.vy;
+}
+
+void BulletStore::remove(unsigned int i)
+{
+    unsigned int last = size() - 1;
+
+    releaseSlot(handles[i]);
+
+    if (i != last)
+    {
+        x[i]     = x[last];
+        y[i]     = y[last];
+        w[i]     = w[last];
+        h[i]     = h[last];
+        radius[i] = radius[last];
+        vx[i]    = vx[last];
+        vy[i]    = vy[last];
+        life[i]  = life[last];
+        turn[i]  = turn[last];
+        flags[i] = flags[last];
+        layer[i] = layer[last];
+        behavior[i] = behavior[last];
+        r[i]     = r[last];
+        g[i]     = g[last];
+        b[i]     = b[last];
+        scripts[i] = std::move(scripts[last]);
+        handles[i] = handles[last];
+
+        slotIndex[handles[i] & SLOT_MASK] = i;
+    }
+
+    x.pop_back();
+    y.pop_back();
+    w.pop_back();
+    h.pop_back();
+    radius.pop_back();
+    vx.pop_back();
+    vy.pop_back();
+    life.pop_back();
+    turn.pop_back();
+    flags.pop_back();
+    layer.pop_back();
+    behavior.pop_back();
+    r.pop_back();
+    g.pop_back();
+    b.pop_back();
+    scripts.pop_back();
+    handles.pop_back();
+}
+
+void BulletStore::removeDead()
+{
+    // Dead bullets are replaced by the last bullet in the store, so don't advance.
+    for (unsigned int i = 0; i < size();)
+    {
+        if (isDead(i))
+        {
+            remove(i);
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+void BulletStore::clear()
+{
+    x.clear();
+    y.clear();
+    w.clear();
+    h.clear();
+    radius.clear();
+    vx.clear();
+    vy.clear();
+    life.clear();
+    turn.clear();
+    flags.clear();
+    layer.clear();
+    behavior.clear();
+    r.clear();
+    g.clear();
+    b.clear();
+    scripts.clear();
+
+    for (Handle handle : handles)
+    {
+        releaseSlot(handle);
+    }
+    handles.clear();
+}
+
+BulletStore::Handle BulletStore::acquireSlot(unsigned int i)
+{
+    std::uint32_t slot;
+    if (freeCount == 0)
+    {
+        // The last slot is never handed out, so no handle equals INVALID_HANDLE.
+        if (slotIndex.size() >= SLOT_MASK)
+            throw std::length_error{"BulletStore: out of handle slots"};
+
+        slot = slotIndex.size();
+        slotIndex.push_back(i);
+        slotGeneration.push_back(0);
+
+        // The queue is empty, so it can grow without moving anything.
+        freeSlots.push_back(0);
+        freeHead = 0;
+    }
+    else
+    {
+        slot = freeSlots[freeHead];
+        slotIndex[slot] = i;
+
+        if (++freeHead == freeSlots.size())
+            freeHead = 0;
+        --freeCount;
+    }
+
+    return (slotGeneration[slot] << SLOT_BITS) | slot;
+}
+
+void BulletStore::releaseSlot(Handle handle)
+{
+    std::uint32_t slot = handle & SLOT_MASK;
+
+    // Bumping the generation invalidates every outstanding handle to this slot. It wraps, so a
+    // handle held across GENERATION_MASK + 1 reuses of its slot resolves again; slots are reused
+    // oldest first to make that as rare as possible.
+    slotGeneration[slot] = (slotGeneration[slot] + 1) & GENERATION_MASK;
+
+    unsigned int tail = freeHead + freeCount;
+    if (tail >= freeSlots.size())
+        tail -= freeSlots.size();
+
+    freeSlots[tail] = slot;
+    ++freeCount;
+}
+
+BulletLuaUtils::Rect BulletStore::getRect(unsigned int i) const
+{
+    return BulletLuaUtils::Rect{x[i], y[i], w[i], h[i]};
+}
+
+void BulletStore::setCenter(unsigned int i, float cx, float cy)
+{
+    x[i] = cx - (w[i] / 2);
+    y[i] = cy - (h[i] / 2);
+}
+
+void BulletStore::setHitbox(unsigned int i, float width, float height)
+{
+    float cx = x[i] + w[i] / 2;
+    float cy = y[i] + h[i] / 2;
+
+    w[i] = std::abs(width);
+    h[i] = std::abs(height);
+    radius[i] = 0.0f;
+
+    setCenter(i, cx, cy);
+}
+
+void BulletStore::setRadius(unsigned int i, float r)
+{
+    // The box becomes the circle's bounds, which is what culling and the grid work with.
+    setHitbox(i, r * 2, r * 2);
+    radius[i] = std::abs(r);
+}
+
+bool BulletStore::isDead(unsigned int i) const
+{
+    return (flags[i] & Dead) != 0;
+}
+
+bool BulletStore::isDying(unsigned int i) const
+{
+    return (flags[i] & Dying) != 0;
+}
+
+void BulletStore::vanish(unsigned int i)
+{
+    flags[i] |= Dying;
+}
+
+void BulletStore::kill(unsigned int i)
+{
+    flags[i] |= Dead;
+}
+
+float BulletStore::getSpeed(unsigned int i) const
+{
+    return Math::getSpeed(vx[i], vy[i]);
+}
+
+void BulletStore::setSpeed(unsigned int i, float speed)
+{
+    Math::setSpeed(vx[i], vy[i], speed);
+}
+
+void BulletStore::setSpeedRelative(unsigned int i, float speed)
+{
+    Math::setSpeedRelative(vx[i], vy[i], speed);
+}
+
+void BulletStore::setSpeedAndDirection(unsigned int i, float speed, float dir)
+{
+    Math::setSpeedAndDirection(vx[i], vy[i], speed, dir);
+}
+
+float BulletStore::getDirection(unsigned int i) const
+{
+    return Math::getDirection(vx[i], vy[i]);
+}
+
+void BulletStore::setDirection(unsigned int i, float dir)
+{
+    Math::setDirection(vx[i], vy[i], dir);
+}
+
+void BulletStore::setDirectionRelative(unsigned int i, float dir)
+{
+    setDirection(i, dir + getDirection(i));
+}
+
+float BulletStore::getAimDirection(unsigned int i, float tx, float ty) const
+{
+    return Math::getAimDirection(x[i], y[i], tx, ty);
+}
+
+void BulletStore::aimAtPoint(unsigned int i, float tx, float ty)
+{
+    setDirection(i, getAimDirection(i, tx, ty));
+}
+
+void BulletStore::setColor(unsigned int i, unsigned char newR, unsigned char newG, unsigned char newB)
+{
+    r[i] = newR;
+    g[i] = newG;
+    b[i] = newB;
+}
+
+void BulletStore::step(const BulletLuaUtils::Rect& area)
+{
+    // Normalize the area once so the per-bullet test is just two overlap checks per axis.
+    const float minX = std::min(area.x, area.x + area.w);
+    const float maxX = std::max(area.x, area.x + area.w);
+    const float minY = std::min(area.y, area.y + area.h);
+    const float maxY = std::max(area.y, area.y + area.h);
+
+    const unsigned int n = size();
+
+    // Positions are handled LANES at a time; the rest of each lane is cheap integer work driven by
+    // the resulting out-of-bounds mask.
+    auto finish = [&](unsigned int i, bool outside)
+    {
+        if (outside)
+            flags[i] |= Dead;
+
+        if (flags[i] & Dying)
+        {
+            life[i] -= FADE_STEP;
+            if (life[i] < 0)
+            {
+                life[i] = 0;
+                flags[i] |= Dead;
+            }
+        }
+
+        turn[i]++;
+    };
+
+    unsigned int i = 0;
+
+#if defined(__AVX__)
+    const unsigned int LANES = 8;
+
+    const __m256 aMinX = _mm256_set1_ps(minX);
+    const __m256 aMaxX = _mm256_set1_ps(maxX);
+    const __m256 aMinY = _mm256_set1_ps(minY);
+    const __m256 aMaxY = _mm256_set1_ps(maxY);
+
+    for (; i + LANES <= n; i += LANES)
+    {
+        __m256 px = _mm256_add_ps(_mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&vx[i]));
+        __m256 py = _mm256_add_ps(_mm256_loadu_ps(&y[i]), _mm256_loadu_ps(&vy[i]));
+        _mm256_storeu_ps(&x[i], px);
+        _mm256_storeu_ps(&y[i], py);
+
+        __m256 right  = _mm256_add_ps(px, _mm256_loadu_ps(&w[i]));
+        __m256 bottom = _mm256_add_ps(py, _mm256_loadu_ps(&h[i]));
+
+        // Same test as Rect::intersects: max(left) < min(right) on both axes.
+        __m256 inX = _mm256_cmp_ps(_mm256_max_ps(px, aMinX), _mm256_min_ps(right, aMaxX), _CMP_LT_OQ);
+        __m256 inY = _mm256_cmp_ps(_mm256_max_ps(py, aMinY), _mm256_min_ps(bottom, aMaxY), _CMP_LT_OQ);
+        int inside = _mm256_movemask_ps(_mm256_and_ps(inX, inY));
+
+        for (unsigned int k = 0; k < LANES; ++k)
+            finish(i + k, !((inside >> k) & 1));
+    }
+#elif defined(__SSE2__)
+    const unsigned int LANES = 4;
+
+    const __m128 aMinX = _mm_set1_ps(minX);
+    const __m128 aMaxX = _mm_set1_ps(maxX);
+    const __m128 aMinY = _mm_set1_ps(minY);
+    const __m128 aMaxY = _mm_set1_ps(maxY);
+
+    for (; i + LANES <= n; i += LANES)
+    {
+        __m128 px = _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_loadu_ps(&vx[i]));
+        __m128 py = _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_loadu_ps(&vy[i]));
+        _mm_storeu_ps(&x[i], px);
+        _mm_storeu_ps(&y[i], py);
+
+        __m128 right  = _mm_add_ps(px, _mm_loadu_ps(&w[i]));
+        __m128 bottom = _mm_add_ps(py, _mm_loadu_ps(&h[i]));
+
+        // Same test as Rect::intersects: max(left) < min(right) on both axes.
+        __m128 inX = _mm_cmplt_ps(_mm_max_ps(px, aMinX), _mm_min_ps(right, aMaxX));
+        __m128 inY = _mm_cmplt_ps(_mm_max_ps(py, aMinY), _mm_min_ps(bottom, aMaxY));
+        int inside = _mm_movemask_ps(_mm_and_ps(inX, inY));
+
+        for (unsigned int k = 0; k < LANES; ++k)
+            finish(i + k, !((inside >> k) & 1));
+    }
+#endif
+
+    // Scalar fallback, and the tail of the vector loops.
+    for (; i < n; ++i)
+    {
+        x[i] += vx[i];
+        y[i] += vy[i];
+
+        bool inside = std::max(x[i], minX) < std::min(x[i] + w[i], maxX) &&
+                      std::max(y[i], minY) < std::min(y[i] + h[i], maxY);
+
+        finish(i, !inside);
+    }
+}
@@ -0,0 +1,216 @@
+#include <bulletlua/ChunkCache.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <sol.hpp>
+
+namespace
+{
+    int writeChunk(lua_State*, const void* p, std::size_t size, void* data)
+    {
+        static_cast<std::string*>(data)->append(static_cast<const char*>(p), size);
+        return 0;
+    }
+
+    int loadBytecode(lua_State* L, const std::string& bytecode, const std::string& name)
+    {
+        return luaL_loadbufferx(L, bytecode.data(), bytecode.size(), name.c_str(), "b");
+    }
+
+    // FNV-1a, to name chunk files.
+    std::string hashName(const std::string& key)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.luac", static_cast<unsigned long long>(hash));
+        return name;
+    }
+
+    // What a chunk file starts with: a tag, the length of the key and the key itself. Names can
+    // collide, and a file can be left over from another build.
+    std::string fileHeader(const std::string& key)
+    {
+        std::uint64_t length = key.size();
+
+        std::string header = "BLCK";
+        header.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        header.append(key);
+
+        return header;
+    }
+}
+
+const unsigned int ChunkCache::DEFAULT_SCRIPT_LIMIT;
+
+ChunkCache::ChunkCache()
+    : mutex{},
+      files{},
+      scripts{},
+      directory{},
+      scriptOrder{},
+      scriptLimit{DEFAULT_SCRIPT_LIMIT}
+{
+}
+
+ChunkCache& ChunkCache::instance()
+{
+    static ChunkCache cache;
+    return cache;
+}
+
+int ChunkCache::loadFile(lua_State* L, const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return luaL_loadfile(L, filename.c_str());
+
+    std::string name = "@" + filename;
+
+    auto found = files.find(filename);
+    if (found != files.end() && found->second.modified == info.st_mtime)
+        return loadBytecode(L, found->second.bytecode, name);
+
+    FileChunk& chunk = files[filename];
+    chunk.modified = info.st_mtime;
+
+    std::ostringstream key;
+    key << filename << '\0' << info.st_mtime;
+
+    if (loadFromDisk(L, key.str(), name, chunk.bytecode))
+        return LUA_OK;
+
+    int status = luaL_loadfile(L, filename.c_str());
+    if (status != LUA_OK)
+    {
+        files.erase(filename);
+        return status;
+    }
+
+    store(L, key.str(), chunk.bytecode);
+    return LUA_OK;
+}
+
+int ChunkCache::loadScript(lua_State* L, const std::string& script)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+
+    // Same chunk name luaL_loadstring uses.
+    const std::string& name = script;
+
+    auto found = scripts.find(script);
+    if (found != scripts.end())
+        return loadBytecode(L, found->second, name);
+
+    std::string bytecode;
+    if (!loadFromDisk(L, script, name, bytecode))
+    {
+        int status = luaL_loadstring(L, script.c_str());
+        if (status != LUA_OK)
+            return status;
+
+        store(L, script, bytecode);
+    }
+
+    auto added = scripts.emplace(script, std::move(bytecode)).first;
+    scriptOrder.push_back(&added->first);
+    trimScripts();
+
+    return LUA_OK;
+}
+
+void ChunkCache::setDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    this->directory = directory;
+}
+
+void ChunkCache::setScriptLimit(unsigned int limit)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    scriptLimit = limit;
+    trimScripts();
+}
+
+void ChunkCache::clear()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    files.clear();
+    scripts.clear();
+    scriptOrder.clear();
+}
+
+unsigned int ChunkCache::size() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return files.size() + scripts.size();
+}
+
+bool ChunkCache::loadFromDisk(lua_State* L, const std::string& key, const std::string& name,
+                              std::string& bytecode)
+{
+    if (directory.empty())
+        return false;
+
+    std::ifstream file{directory + "/" + hashName(key), std::ios::binary};
+    if (!file)
+        return false;
+
+    std::string contents{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+
+    // Written for another key.
+    std::string header = fileHeader(key);
+    if (contents.size() < header.size() ||
+        std::memcmp(contents.data(), header.data(), header.size()) != 0)
+        return false;
+
+    bytecode.assign(contents, header.size(), std::string::npos);
+
+    if (loadBytecode(L, bytecode, name) != LUA_OK)
+    {
+        // Stale or corrupt. Compile from source instead.
+        lua_pop(L, 1);
+        bytecode.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ChunkCache::store(lua_State* L, const std::string& key, std::string& bytecode)
+{
+    bytecode.clear();
+    lua_dump(L, &writeChunk, &bytecode);
+
+    if (directory.empty())
+        return;
+
+    std::string header = fileHeader(key);
+
+    std::ofstream file{directory + "/" + hashName(key), std::ios::binary};
+    file.write(header.data(), header.size());
+    file.write(bytecode.data(), bytecode.size());
+}
+
+void ChunkCache::trimScripts()
+{
+    while (scripts.size() > scriptLimit)
+    {
+        scripts.erase(scripts.find(*scriptOrder.front()));
+        scriptOrder.pop_front();
+    }
+}
@@ -0,0 +1,200 @@
+#include <bulletlua/LuaStatePool.hpp>
+
+namespace
+{
+    // Registry keys of each state's copies of its initial tables, and of their metatables. Both
+    // are keyed by the original table.
+    const char snapshotKey = 0;
+    const char metatableKey = 0;
+
+    // Copy the table at `index` and its metatable into the snapshot tables at `snapshots` and
+    // `metatables`, unless it is there already.
+    void remember(lua_State* L, int snapshots, int metatables, int index)
+    {
+        lua_pushvalue(L, index);
+        lua_rawget(L, snapshots);
+        bool known = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+
+        if (known)
+            return;
+
+        lua_pushvalue(L, index);
+        lua_newtable(L);
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0)
+        {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
+        }
+        lua_rawset(L, snapshots);
+
+        if (lua_getmetatable(L, index))
+        {
+            lua_pushvalue(L, index);
+            lua_insert(L, -2);
+            lua_rawset(L, metatables);
+        }
+    }
+
+    // Make the table at `index` hold exactly the fields of the copy at `copy` again.
+    void restore(lua_State* L, int index, int copy)
+    {
+        // Drop fields the pattern added and restore ones it overwrote. Assigning to existing
+        // fields (nil included) is allowed while traversing.
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0)
+        {
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            lua_pushvalue(L, -1);
+            lua_rawget(L, copy);
+            lua_rawset(L, index);
+        }
+
+        // Bring back ones it removed.
+        lua_pushnil(L);
+        while (lua_next(L, copy) != 0)
+        {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, index);
+        }
+    }
+}
+
+LuaStatePool::LuaStatePool(Initializer initializer)
+    : initializer{initializer},
+      idle{new Idle{std::vector<sol::state*>{}, true}}
+{
+}
+
+LuaStatePool::~LuaStatePool()
+{
+    // States still in use are closed when they are released.
+    idle->open = false;
+
+    for (sol::state* state : idle->states)
+    {
+        delete state;
+    }
+    idle->states.clear();
+}
+
+std::shared_ptr<sol::state> LuaStatePool::acquire()
+{
+    sol::state* state = nullptr;
+
+    if (idle->states.empty())
+    {
+        state = create();
+    }
+    else
+    {
+        state = idle->states.back();
+        idle->states.pop_back();
+
+        reset(*state);
+    }
+
+    std::shared_ptr<Idle> owner = idle;
+    return std::shared_ptr<sol::state>(state,
+                                       [owner](sol::state* released)
+                                       {
+                                           if (owner->open)
+                                               owner->states.push_back(released);
+                                           else
+                                               delete released;
+                                       });
+}
+
+void LuaStatePool::prewarm(unsigned int count)
+{
+    idle->states.reserve(count);
+
+    while (idle->states.size() < count)
+    {
+        idle->states.push_back(create());
+    }
+}
+
+unsigned int LuaStatePool::idleCount() const
+{
+    return idle->states.size();
+}
+
+sol::state* LuaStatePool::create()
+{
+    std::unique_ptr<sol::state> state{new sol::state};
+    initializer(*state);
+
+    // Remember the initial globals for reset(), along with the tables a pattern could patch to
+    // change how the next one runs: libraries, the API fallback behind the globals and the
+    // string metatable.
+    lua_State* L = state->lua_state();
+
+    lua_newtable(L);
+    int snapshots = lua_gettop(L);
+    lua_newtable(L);
+    int metatables = lua_gettop(L);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+    int globals = lua_gettop(L);
+    remember(L, snapshots, metatables, globals);
+
+    lua_pushnil(L);
+    while (lua_next(L, globals) != 0)
+    {
+        if (lua_istable(L, -1))
+            remember(L, snapshots, metatables, lua_gettop(L));
+        lua_pop(L, 1);
+    }
+
+    if (lua_getmetatable(L, globals))
+    {
+        int meta = lua_gettop(L);
+        remember(L, snapshots, metatables, meta);
+
+        lua_getfield(L, meta, "__index");
+        if (lua_istable(L, -1))
+            remember(L, snapshots, metatables, lua_gettop(L));
+    }
+
+    lua_pushstring(L, "");
+    if (lua_getmetatable(L, -1))
+        remember(L, snapshots, metatables, lua_gettop(L));
+
+    lua_settop(L, metatables);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &metatableKey);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &snapshotKey);
+
+    return state.release();
+}
+
+void LuaStatePool::reset(sol::state& state)
+{
+    lua_State* L = state.lua_state();
+    int top = lua_gettop(L);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &snapshotKey);
+    int snapshots = lua_gettop(L);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &metatableKey);
+    int metatables = lua_gettop(L);
+
+    lua_pushnil(L);
+    while (lua_next(L, snapshots) != 0)
+    {
+        int table = lua_gettop(L) - 1;
+        restore(L, table, table + 1);
+
+        // Nil if it had none.
+        lua_pushvalue(L, table);
+        lua_rawget(L, metatables);
+        lua_setmetatable(L, table);
+
+        lua_pop(L, 1);
+    }
+
+    lua_settop(L, top);
+}
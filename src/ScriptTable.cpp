@@ -0,0 +1,179 @@
+#include <bulletlua/ScriptTable.hpp>
+
+const unsigned int ScriptTable::FUNCTION_BLOCK_BITS;
+const unsigned int ScriptTable::FUNCTION_BLOCK;
+const unsigned int ScriptTable::MAX_FUNCTION_BLOCKS;
+
+ScriptTable::ScriptTable()
+    : states(1),
+      freeStates{},
+      stateIds{},
+      functions{},
+      functionEnd{1},
+      freeFunctions{},
+      functionIds{},
+      lock{}
+{
+    functions[0].reset(new Function[FUNCTION_BLOCK]);
+}
+
+ScriptTable::~ScriptTable()
+{
+    // States may go back to a pool, so don't leave references behind in them.
+    for (Id id = 1; id < functionEnd; ++id)
+    {
+        const Function& function = functionAt(id);
+        if (function.users != 0)
+            luaL_unref(states[function.state].lua->lua_state(), LUA_REGISTRYINDEX, function.ref);
+    }
+}
+
+ScriptTable::Id ScriptTable::state(std::shared_ptr<sol::state> lua)
+{
+    auto found = stateIds.find(lua.get());
+    if (found != stateIds.end())
+        return found->second;
+
+    Id id;
+    if (freeStates.empty())
+    {
+        id = states.size();
+        states.push_back(State{});
+    }
+    else
+    {
+        id = freeStates.back();
+        freeStates.pop_back();
+    }
+
+    stateIds.emplace(lua.get(), id);
+    states[id] = State{std::move(lua), 0};
+
+    return id;
+}
+
+ScriptTable::Id ScriptTable::function(Id state, lua_State* L, int index)
+{
+    // Raise errors outside the lock.
+    luaL_checktype(L, index, LUA_TFUNCTION);
+
+    Id id;
+    {
+        std::lock_guard<std::mutex> guard{lock};
+
+        const void* key = lua_topointer(L, index);
+        auto found = functionIds.find(key);
+        if (found != functionIds.end())
+            return found->second;
+
+        if (!freeFunctions.empty())
+        {
+            id = freeFunctions.back();
+            freeFunctions.pop_back();
+        }
+        else if (functionEnd < MAX_FUNCTION_BLOCKS * FUNCTION_BLOCK)
+        {
+            id = functionEnd++;
+
+            std::unique_ptr<Function[]>& block = functions[id >> FUNCTION_BLOCK_BITS];
+            if (!block)
+                block.reset(new Function[FUNCTION_BLOCK]);
+        }
+        else
+        {
+            id = NONE;
+        }
+
+        if (id != NONE)
+        {
+            // The registry is shared by every thread of a state, so the reference outlives
+            // coroutines.
+            lua_pushvalue(L, index);
+            functionAt(id) = Function{luaL_ref(L, LUA_REGISTRYINDEX), key, state, 0};
+            functionIds.emplace(key, id);
+
+            // Only this state's scripts can be interning its functions, so this doesn't race
+            // with anything either.
+            states[state].users += 1;
+        }
+    }
+
+    if (id == NONE)
+        luaL_error(L, "too many functions in use");
+
+    return id;
+}
+
+void ScriptTable::retainState(Id id, unsigned int n)
+{
+    if (id != NONE)
+        states[id].users += n;
+}
+
+void ScriptTable::releaseState(Id id, unsigned int n)
+{
+    if (id == NONE)
+        return;
+
+    State& state = states[id];
+    state.users -= n;
+    if (state.users != 0)
+        return;
+
+    stateIds.erase(state.lua.get());
+    state.lua.reset();
+    freeStates.push_back(id);
+}
+
+void ScriptTable::retainFunction(Id id, unsigned int n)
+{
+    if (id != NONE)
+        functionAt(id).users += n;
+}
+
+void ScriptTable::releaseFunction(Id id, unsigned int n)
+{
+    if (id == NONE)
+        return;
+
+    Function& function = functionAt(id);
+    function.users -= n;
+    if (function.users != 0)
+        return;
+
+    luaL_unref(states[function.state].lua->lua_state(), LUA_REGISTRYINDEX, function.ref);
+    functionIds.erase(function.key);
+    freeFunctions.push_back(id);
+
+    releaseState(function.state, 1);
+}
+
+lua_State* ScriptTable::luaState(Id id) const
+{
+    return states[id].lua->lua_state();
+}
+
+void ScriptTable::push(lua_State* L, Id id) const
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, functionAt(id).ref);
+}
+
+unsigned int ScriptTable::stateCount() const
+{
+    return stateIds.size();
+}
+
+unsigned int ScriptTable::functionCount() const
+{
+    return functionIds.size();
+}
+
+ScriptTable::Function& ScriptTable::functionAt(Id id)
+{
+    return functions[id >> FUNCTION_BLOCK_BITS][id & (FUNCTION_BLOCK - 1)];
+}
+
+const ScriptTable::Function& ScriptTable::functionAt(Id id) const
+{
+    return functions[id >> FUNCTION_BLOCK_BITS][id & (FUNCTION_BLOCK - 1)];
+}
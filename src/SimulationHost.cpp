@@ -0,0 +1,127 @@
+#include <bulletlua/SimulationHost.hpp>
+#include <bulletlua/ChunkCache.hpp>
+
+#include <chrono>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+}
+
+SimulationHost::SimulationHost(unsigned int workers)
+    : pool{workers},
+      instances{},
+      ticks{0},
+      rate{0.0}
+{
+}
+
+unsigned int SimulationHost::add(int left, int top, int width, int height,
+                                 const BulletLuaUtils::Rect& player, std::uint_fast64_t seed)
+{
+    Factory create = [=](BulletLuaUtils::Rect& p)
+    {
+        return std::unique_ptr<BulletLuaManager>{new BulletLuaManager{left, top, width, height, p}};
+    };
+
+    return add(create, player, seed);
+}
+
+unsigned int SimulationHost::add(const Factory& create, const BulletLuaUtils::Rect& player,
+                                 std::uint_fast64_t seed)
+{
+    std::unique_ptr<Instance> instance{new Instance{player, nullptr, 0}};
+    instance->manager = create(instance->player);
+    instance->manager->seed(seed);
+
+    instances.push_back(std::move(instance));
+    return instances.size() - 1;
+}
+
+void SimulationHost::clear()
+{
+    instances.clear();
+    ticks = 0;
+    rate = 0.0;
+}
+
+unsigned int SimulationHost::size() const
+{
+    return instances.size();
+}
+
+BulletLuaManager& SimulationHost::manager(unsigned int instance)
+{
+    return *instances[instance]->manager;
+}
+
+BulletLuaUtils::Rect& SimulationHost::player(unsigned int instance)
+{
+    return instances[instance]->player;
+}
+
+unsigned int SimulationHost::frame(unsigned int instance) const
+{
+    return instances[instance]->frame;
+}
+
+bool SimulationHost::preloadFile(const std::string& filename)
+{
+    sol::state lua;
+    bool compiled = ChunkCache::instance().loadFile(lua.lua_state(), filename) == LUA_OK;
+    lua_pop(lua.lua_state(), 1);
+
+    return compiled;
+}
+
+bool SimulationHost::preloadScript(const std::string& script)
+{
+    sol::state lua;
+    bool compiled = ChunkCache::instance().loadScript(lua.lua_state(), script) == LUA_OK;
+    lua_pop(lua.lua_state(), 1);
+
+    return compiled;
+}
+
+void SimulationHost::advance(unsigned int frames, const Input& input)
+{
+    auto start = Clock::now();
+
+    // Each job owns its instance outright, so nothing here needs a lock.
+    pool.run(instances.size(), [&](unsigned int i)
+    {
+        Instance& instance = *instances[i];
+
+        for (unsigned int f = 0; f < frames; ++f)
+        {
+            if (input)
+                input(i, instance.frame, *instance.manager, instance.player);
+
+            instance.manager->tick();
+            ++instance.frame;
+        }
+    });
+
+    auto end = Clock::now();
+
+    unsigned long long ran = (unsigned long long)frames * instances.size();
+    ticks += ran;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    rate = seconds > 0.0 ? ran / seconds : 0.0;
+}
+
+double SimulationHost::ticksPerSecond() const
+{
+    return rate;
+}
+
+unsigned long long SimulationHost::totalTicks() const
+{
+    return ticks;
+}
+
+unsigned int SimulationHost::threadCount() const
+{
+    return pool.size();
+}
@@ -0,0 +1,71 @@
+#include <bulletlua/Snapshot.hpp>
+
+const unsigned int SnapshotBuffer::FRESH;
+
+unsigned int Snapshot::size() const
+{
+    return x.size();
+}
+
+void Snapshot::capture(const BulletStore& bullets, unsigned int tick)
+{
+    const unsigned int count = bullets.size();
+
+    frame = tick;
+
+    // assign() reuses the arrays' storage.
+    x.assign(bullets.x.begin(), bullets.x.begin() + count);
+    y.assign(bullets.y.begin(), bullets.y.begin() + count);
+    w.assign(bullets.w.begin(), bullets.w.begin() + count);
+    h.assign(bullets.h.begin(), bullets.h.begin() + count);
+    radius.assign(bullets.radius.begin(), bullets.radius.begin() + count);
+    life.assign(bullets.life.begin(), bullets.life.begin() + count);
+    flags.assign(bullets.flags.begin(), bullets.flags.begin() + count);
+    r.assign(bullets.r.begin(), bullets.r.begin() + count);
+    g.assign(bullets.g.begin(), bullets.g.begin() + count);
+    b.assign(bullets.b.begin(), bullets.b.begin() + count);
+    handles.assign(bullets.handles.begin(), bullets.handles.begin() + count);
+
+    direction.resize(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        direction[i] = bullets.getDirection(i);
+    }
+}
+
+SnapshotBuffer::SnapshotBuffer()
+    : snapshots{},
+      writing{0},
+      reading{1},
+      middle{2}
+{
+    for (Snapshot& snapshot : snapshots)
+    {
+        snapshot.frame = 0;
+    }
+}
+
+Snapshot& SnapshotBuffer::back()
+{
+    return snapshots[writing];
+}
+
+void SnapshotBuffer::publish()
+{
+    // Release makes the writes to the snapshot visible to the reader that picks it up.
+    writing = middle.exchange(writing | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+bool SnapshotBuffer::update()
+{
+    if (!(middle.load(std::memory_order_relaxed) & FRESH))
+        return false;
+
+    reading = middle.exchange(reading, std::memory_order_acq_rel) & ~FRESH;
+    return true;
+}
+
+const Snapshot& SnapshotBuffer::front() const
+{
+    return snapshots[reading];
+}
@@ -1,89 +1,591 @@
 #include <bulletlua/SpacialPartition.hpp>
-#include <bulletlua/Bullet.hpp>
+#include <bulletlua/BulletStore.hpp>
 
-#include <cstring>
-#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
-SpacialPartition::SpacialPartition(const BulletLuaUtils::Rect& area)
-    : screenArea{area}
+namespace
 {
-    reset();
+    // Narrow phase. Both sides are normalized already; edges that only touch don't count,
+    // matching Rect::intersects.
+    inline bool boxBox(float aMinX, float aMinY, float aMaxX, float aMaxY,
+                       float bMinX, float bMinY, float bMaxX, float bMaxY)
+    {
+        return aMinX < bMaxX && bMinX < aMaxX &&
+               aMinY < bMaxY && bMinY < aMaxY;
+    }
+
+    inline bool circleBox(float cx, float cy, float r,
+                          float minX, float minY, float maxX, float maxY)
+    {
+        float dx = cx - std::min(std::max(cx, minX), maxX);
+        float dy = cy - std::min(std::max(cy, minY), maxY);
+
+        return dx * dx + dy * dy < r * r;
+    }
+
+    inline bool circleCircle(float ax, float ay, float ar, float bx, float by, float br)
+    {
+        float dx = ax - bx;
+        float dy = ay - by;
+        float r = ar + br;
+
+        return dx * dx + dy * dy < r * r;
+    }
+
+    // Does the segment from (x, y) to (x + dx, y + dy) pass through the box? Slab test.
+    inline bool segmentBox(float x, float y, float dx, float dy,
+                           float minX, float minY, float maxX, float maxY)
+    {
+        float tMin = 0.0f;
+        float tMax = 1.0f;
+
+        const float origin[2]    = {x, y};
+        const float direction[2] = {dx, dy};
+        const float lower[2]     = {minX, minY};
+        const float upper[2]     = {maxX, maxY};
+
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            if (std::abs(direction[axis]) < FLT_EPSILON)
+            {
+                if (origin[axis] <= lower[axis] || origin[axis] >= upper[axis])
+                    return false;
+
+                continue;
+            }
+
+            float inv = 1.0f / direction[axis];
+            float t1 = (lower[axis] - origin[axis]) * inv;
+            float t2 = (upper[axis] - origin[axis]) * inv;
+
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+
+            if (tMin >= tMax)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Squared distance from (px, py) to the segment from (x, y) to (x + dx, y + dy).
+    inline float segmentPointDistanceSq(float x, float y, float dx, float dy, float px, float py)
+    {
+        float t = ((px - x) * dx + (py - y) * dy) / (dx * dx + dy * dy);
+        t = std::min(std::max(t, 0.0f), 1.0f);
+
+        float ex = x + dx * t - px;
+        float ey = y + dy * t - py;
+
+        return ex * ex + ey * ey;
+    }
 }
 
-void SpacialPartition::addBullet(const Bullet* bullet)
+constexpr float SpacialPartition::DEFAULT_TILE_SIZE;
+constexpr float SpacialPartition::MIN_TILE_SIZE;
+constexpr float SpacialPartition::MAX_TILE_SIZE;
+constexpr float SpacialPartition::TARGET_DENSITY;
+constexpr unsigned int SpacialPartition::PARALLEL_THRESHOLD;
+
+SpacialPartition::SpacialPartition(const BulletStore& store, const BulletLuaUtils::Rect& area,
+                                   CollisionLayer layer, float tileSize)
+    : tileSize{0.0f}, invTileSize{0.0f},
+      columns{0}, rows{0},
+      cellStart{}, entries{},
+      spans{}, bulletShapes{}, cellFill{},
+      chunkCells{}, rangeStart{},
+      pool{nullptr},
+      swept{false},
+      bullets(store),
+      layer{layer},
+      screenArea{area},
+      left{std::min(area.x, area.x + area.w)},
+      top{std::min(area.y, area.y + area.h)}
 {
-    if (bullet->dying || bullet->dead)
-        return;
+    setTileSize(tileSize);
+}
+
+void SpacialPartition::setTileSize(float size)
+{
+    tileSize = size;
+    invTileSize = 1.0f / size;
+
+    // Round up so the last row/column covers the remainder of the area.
+    columns = std::max(1, int(std::ceil(std::abs(screenArea.w) * invTileSize)));
+    rows    = std::max(1, int(std::ceil(std::abs(screenArea.h) * invTileSize)));
+
+    cellStart.assign(columns * rows + 1, 0);
+    cellFill.assign(columns * rows, 0);
+    entries.clear();
+}
 
-    // Abuse integer division to determine which array cell this bullet belongs to.
-    int x = bullet->position.x / tileSize;
-    int y = bullet->position.y / tileSize;
+float SpacialPartition::getTileSize() const
+{
+    return tileSize;
+}
+
+void SpacialPartition::tune(unsigned int bulletCount)
+{
+    float area = std::abs(screenArea.w * screenArea.h);
+    float ideal = std::sqrt(area * TARGET_DENSITY / std::max(bulletCount, 1u));
+    ideal = std::min(std::max(ideal, MIN_TILE_SIZE), MAX_TILE_SIZE);
+
+    if (ideal > tileSize * 2.0f || ideal < tileSize * 0.5f)
+    {
+        setTileSize(ideal);
+    }
+}
+
+void SpacialPartition::setSweptCollision(bool enabled)
+{
+    swept = enabled;
+}
 
-    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
+bool SpacialPartition::getSweptCollision() const
+{
+    return swept;
+}
+
+int SpacialPartition::getColumns() const
+{
+    return columns;
+}
+
+int SpacialPartition::getRows() const
+{
+    return rows;
+}
+
+bool SpacialPartition::tileRange(float minX, float minY, float maxX, float maxY,
+                                 TileRange& range) const
+{
+    range.x0 = std::max(column(minX), 0);
+    range.y0 = std::max(row(minY), 0);
+    range.x1 = std::min(column(maxX), columns - 1);
+    range.y1 = std::min(row(maxY), rows - 1);
+
+    if (range.x0 > range.x1 || range.y0 > range.y1)
+    {
+        range.x0 = -1;
+        return false;
+    }
+
+    return true;
+}
+
+template <typename F>
+bool SpacialPartition::forEachCandidate(float minX, float minY, float maxX, float maxY, F f) const
+{
+    TileRange query;
+
+    // If the box is outside our defined space, don't bother.
+    if (!tileRange(minX, minY, maxX, maxY, query))
+        return false;
+
+    for (int ty = query.y0; ty <= query.y1; ++ty)
+    {
+        for (int tx = query.x0; tx <= query.x1; ++tx)
+        {
+            int cell = ty * columns + tx;
+            for (unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; ++i)
+            {
+                unsigned int index = entries[i];
+                const TileRange& span = spans[index];
+
+                // Only handle the pair in the first tile both boxes share.
+                if (std::max(span.x0, query.x0) != tx || std::max(span.y0, query.y0) != ty)
+                    continue;
+
+                if (f(index, shapes[i]))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool SpacialPartition::bin(unsigned int i)
+{
+    TileRange& span = spans[i];
+    span.x0 = -1;
+
+    unsigned char flags = bullets.flags[i];
+    if (!(flags & BulletStore::Collision) || (flags & (BulletStore::Dying | BulletStore::Dead)))
+        return false;
+
+    if (bullets.layer[i] != layer)
+        return false;
+
+    float x = bullets.x[i];
+    float y = bullets.y[i];
+    float w = bullets.w[i];
+    float h = bullets.h[i];
+
+    Shape& shape = bulletShapes[i];
+    shape.minX = std::min(x, x + w);
+    shape.minY = std::min(y, y + h);
+    shape.maxX = std::max(x, x + w);
+    shape.maxY = std::max(y, y + h);
+    shape.radius = bullets.radius[i];
+    shape.sweepX = 0.0f;
+    shape.sweepY = 0.0f;
+
+    // The bullet moved by exactly its velocity in BulletStore::step.
+    float vx = bullets.vx[i];
+    float vy = bullets.vy[i];
+
+    if (swept && (std::abs(vx) > shape.maxX - shape.minX || std::abs(vy) > shape.maxY - shape.minY))
+    {
+        shape.sweepX = vx;
+        shape.sweepY = vy;
+
+        // Bin the whole path.
+        return tileRange(std::min(shape.minX, shape.minX - vx), std::min(shape.minY, shape.minY - vy),
+                         std::max(shape.maxX, shape.maxX - vx), std::max(shape.maxY, shape.maxY - vy),
+                         span);
+    }
+
+    return tileRange(shape.minX, shape.minY, shape.maxX, shape.maxY, span);
+}
+
+void SpacialPartition::build()
+{
+    const unsigned int count = bullets.size();
+    const unsigned int cells = columns * rows;
+
+    spans.resize(count);
+    bulletShapes.resize(count);
+
+    if (pool != nullptr && pool->size() > 1 && count >= PARALLEL_THRESHOLD)
+    {
+        buildParallel();
         return;
+    }
+
+    // Pass 1: find each bullet's tiles and count tile populations.
+    // Counts go into cellStart[c + 1] so the prefix sum below leaves cellStart[c] as the offset.
+    std::fill(cellStart.begin(), cellStart.end(), 0);
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (!bin(i))
+            continue;
+
+        const TileRange& span = spans[i];
+        for (int ty = span.y0; ty <= span.y1; ++ty)
+        {
+            for (int tx = span.x0; tx <= span.x1; ++tx)
+            {
+                ++cellStart[ty * columns + tx + 1];
+            }
+        }
+    }
 
-    if (bulletCount[x][y] < CAP)
+    for (unsigned int c = 0; c < cells; ++c)
     {
-        space[x][y][bulletCount[x][y]] = bullet;
-        ++bulletCount[x][y];
+        cellStart[c + 1] += cellStart[c];
     }
+
+    // Pass 2: scatter. Walking bullets in order keeps each tile sorted by index.
+    entries.resize(cellStart[cells]);
+    shapes.resize(cellStart[cells]);
+    std::copy(cellStart.begin(), cellStart.end() - 1, cellFill.begin());
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const TileRange& span = spans[i];
+        if (span.x0 < 0)
+            continue;
+
+        for (int ty = span.y0; ty <= span.y1; ++ty)
+        {
+            for (int tx = span.x0; tx <= span.x1; ++tx)
+            {
+                unsigned int entry = cellFill[ty * columns + tx]++;
+                entries[entry] = i;
+                shapes[entry] = bulletShapes[i];
+            }
+        }
+    }
+}
+
+void SpacialPartition::buildParallel()
+{
+    const unsigned int count = bullets.size();
+    const unsigned int cells = columns * rows;
+
+    // Bullets are split into one contiguous chunk per thread, and tiles into as many ranges.
+    const unsigned int chunks = pool->size();
+    const unsigned int chunkSize = (count + chunks - 1) / chunks;
+    const unsigned int rangeSize = (cells + chunks - 1) / chunks;
+
+    chunkCells.assign(chunks * cells, 0);
+    rangeStart.assign(chunks + 1, 0);
+
+    // Pass 1: histogram. Each chunk counts its own bullets per tile.
+    pool->run(chunks, [&](unsigned int k)
+    {
+        unsigned int* counts = &chunkCells[k * cells];
+        unsigned int end = std::min(count, (k + 1) * chunkSize);
+
+        for (unsigned int i = k * chunkSize; i < end; ++i)
+        {
+            if (!bin(i))
+                continue;
+
+            const TileRange& span = spans[i];
+            for (int ty = span.y0; ty <= span.y1; ++ty)
+            {
+                for (int tx = span.x0; tx <= span.x1; ++tx)
+                {
+                    ++counts[ty * columns + tx];
+                }
+            }
+        }
+    });
+
+    // Pass 2: prefix sum. Each range of tiles totals its counts, the totals are scanned, and
+    // then each range turns its counts into offsets. Within a tile, chunk k's entries come
+    // before chunk k + 1's, so entries end up in bullet order like in a serial build.
+    pool->run(chunks, [&](unsigned int r)
+    {
+        unsigned int end = std::min(cells, (r + 1) * rangeSize);
+        unsigned int total = 0;
+
+        for (unsigned int c = r * rangeSize; c < end; ++c)
+        {
+            for (unsigned int k = 0; k < chunks; ++k)
+            {
+                total += chunkCells[k * cells + c];
+            }
+        }
+
+        rangeStart[r + 1] = total;
+    });
+
+    for (unsigned int r = 0; r < chunks; ++r)
+    {
+        rangeStart[r + 1] += rangeStart[r];
+    }
+
+    pool->run(chunks, [&](unsigned int r)
+    {
+        unsigned int end = std::min(cells, (r + 1) * rangeSize);
+        unsigned int offset = rangeStart[r];
+
+        for (unsigned int c = r * rangeSize; c < end; ++c)
+        {
+            cellStart[c] = offset;
+
+            for (unsigned int k = 0; k < chunks; ++k)
+            {
+                unsigned int n = chunkCells[k * cells + c];
+                chunkCells[k * cells + c] = offset;
+                offset += n;
+            }
+        }
+    });
+
+    cellStart[cells] = rangeStart[chunks];
+
+    // Pass 3: scatter. Each chunk fills its own slots of every tile.
+    entries.resize(cellStart[cells]);
+    shapes.resize(cellStart[cells]);
+
+    pool->run(chunks, [&](unsigned int k)
+    {
+        unsigned int* fill = &chunkCells[k * cells];
+        unsigned int end = std::min(count, (k + 1) * chunkSize);
+
+        for (unsigned int i = k * chunkSize; i < end; ++i)
+        {
+            const TileRange& span = spans[i];
+            if (span.x0 < 0)
+                continue;
+
+            for (int ty = span.y0; ty <= span.y1; ++ty)
+            {
+                for (int tx = span.x0; tx <= span.x1; ++tx)
+                {
+                    unsigned int entry = fill[ty * columns + tx]++;
+                    entries[entry] = i;
+                    shapes[entry] = bulletShapes[i];
+                }
+            }
+        }
+    });
+}
+
+void SpacialPartition::setThreadPool(ThreadPool* threads)
+{
+    pool = threads;
 }
 
 void SpacialPartition::reset()
 {
-    // More or less "lazy-deletion" of our bullet pointers.
-    std::memset(bulletCount, 0, sizeof(int) * WIDTH * HEIGHT);
-    // std::memset(space, 0, sizeof(Bullet*) * WIDTH * HEIGHT * CAP);
+    std::fill(cellStart.begin(), cellStart.end(), 0);
+    entries.clear();
+    shapes.clear();
+}
+
+unsigned int SpacialPartition::entryCount() const
+{
+    return entries.size();
 }
 
 // Checks if bullet is still in the testable area
 bool SpacialPartition::checkOutOfBounds(const BulletLuaUtils::Rect& b) const
 {
-    // BulletLuaUtils::Rect thisBullet(b.position.x, b.position.y, 4.0f, 4.0f);
     return !screenArea.intersects(b);
 }
 
-// Point-to-point collision test.
+const BulletLuaUtils::Rect& SpacialPartition::getArea() const
+{
+    return screenArea;
+}
+
+// Rect-to-bullet collision test.
 bool SpacialPartition::checkCollision(const BulletLuaUtils::Rect& b) const
 {
-    int x = b.x / tileSize;
-    int y = b.y / tileSize;
+    const float minX = std::min(b.x, b.x + b.w);
+    const float minY = std::min(b.y, b.y + b.h);
+    const float maxX = std::max(b.x, b.x + b.w);
+    const float maxY = std::max(b.y, b.y + b.h);
 
-    // If the position of the bullet passed as an argument is outside our defined space, don't
-    // bother.
-    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
-        return false;
+    return forEachCandidate(minX, minY, maxX, maxY,
+                            [&](unsigned int, const Shape& s)
+                            {
+                                return intersectsBox(s, minX, minY, maxX, maxY);
+                            });
+}
+
+// Circle-to-bullet collision test.
+bool SpacialPartition::checkCollision(float cx, float cy, float radius) const
+{
+    return forEachCandidate(cx - radius, cy - radius, cx + radius, cy + radius,
+                            [&](unsigned int, const Shape& s)
+                            {
+                                return intersectsCircle(s, cx, cy, radius);
+                            });
+}
+
+CollisionResult SpacialPartition::query(const BulletLuaUtils::Rect& b, float grazeRadius,
+                                        BulletStore::Handle* hits, unsigned int capacity) const
+{
+    const float minX = std::min(b.x, b.x + b.w);
+    const float minY = std::min(b.y, b.y + b.h);
+    const float maxX = std::max(b.x, b.x + b.w);
+    const float maxY = std::max(b.y, b.y + b.h);
+
+    CollisionResult result{0, 0, FLT_MAX};
+
+    // Anything that can graze is within grazeRadius of the rect, so one pass over the grown
+    // rect's tiles sees every hit as well.
+    forEachCandidate(minX - grazeRadius, minY - grazeRadius, maxX + grazeRadius, maxY + grazeRadius,
+                     [&](unsigned int index, const Shape& s)
+                     {
+                         if (intersectsBox(s, minX, minY, maxX, maxY))
+                         {
+                             if (result.hits < capacity)
+                                 hits[result.hits] = bullets.handles[index];
+
+                             ++result.hits;
+                             result.nearest = 0.0f;
+                             return false;
+                         }
+
+                         // Gap between the rect and the bullet's hitbox at its current position.
+                         float distance;
+                         if (s.radius > 0.0f)
+                         {
+                             float cx = (s.minX + s.maxX) * 0.5f;
+                             float cy = (s.minY + s.maxY) * 0.5f;
+                             float dx = cx - std::min(std::max(cx, minX), maxX);
+                             float dy = cy - std::min(std::max(cy, minY), maxY);
+
+                             distance = std::max(std::sqrt(dx * dx + dy * dy) - s.radius, 0.0f);
+                         }
+                         else
+                         {
+                             float dx = std::max(std::max(s.minX - maxX, minX - s.maxX), 0.0f);
+                             float dy = std::max(std::max(s.minY - maxY, minY - s.maxY), 0.0f);
+
+                             distance = std::sqrt(dx * dx + dy * dy);
+                         }
+
+                         if (distance <= grazeRadius)
+                         {
+                             ++result.grazes;
+                             result.nearest = std::min(result.nearest, distance);
+                         }
 
-    BulletLuaUtils::Rect thisBullet{b};
+                         return false;
+                     });
 
-    for (int i = 0; i < bulletCount[x][y]; i++)
+    return result;
+}
+
+bool SpacialPartition::intersectsBox(const Shape& s, float minX, float minY, float maxX, float maxY)
+{
+    float cx = (s.minX + s.maxX) * 0.5f;
+    float cy = (s.minY + s.maxY) * 0.5f;
+
+    if (s.sweepX != 0.0f || s.sweepY != 0.0f)
     {
-        BulletLuaUtils::Rect thatBullet{space[x][y][i]->position};
-        // thatBullet.x = space[x][y][i]->position.x;
-        // thatBullet.x = space[x][y][i]->position.y;
+        // Sweep the bullet's center through the rect grown by the bullet's half size (or radius,
+        // ignoring rounded corners).
+        float hw = s.radius > 0.0f ? s.radius : (s.maxX - s.minX) * 0.5f;
+        float hh = s.radius > 0.0f ? s.radius : (s.maxY - s.minY) * 0.5f;
 
-        if (thisBullet.intersects(thatBullet))
-            return true;
+        return segmentBox(cx - s.sweepX, cy - s.sweepY, s.sweepX, s.sweepY,
+                          minX - hw, minY - hh, maxX + hw, maxY + hh);
     }
 
-    return false;
+    if (s.radius > 0.0f)
+        return circleBox(cx, cy, s.radius, minX, minY, maxX, maxY);
+
+    return boxBox(minX, minY, maxX, maxY, s.minX, s.minY, s.maxX, s.maxY);
 }
 
-// // Point-to-rect collision test.
-// bool SpacialPartition::checkCollision(int x, int y, int width, int height)
-// {
-//     int xMin = x / tileSize;
-//     int xMax = (x + width) / tileSize;
-//
-//     int yMin = y / tileSize;
-//     int yMax = (y + height) / tileSize;
-//
-//     for (int j = yMin; j < yMax; ++j)
-//     {
-//         for (int i = xMin; i < xMax; ++i)
-//         {
-//             return false;
-//         }
-//     }
-//     return false;
-// }
+bool SpacialPartition::intersectsCircle(const Shape& s, float cx, float cy, float radius)
+{
+    float sx = (s.minX + s.maxX) * 0.5f;
+    float sy = (s.minY + s.maxY) * 0.5f;
+
+    if (s.sweepX != 0.0f || s.sweepY != 0.0f)
+    {
+        if (s.radius > 0.0f)
+        {
+            // Capsule vs circle.
+            float r = radius + s.radius;
+            return segmentPointDistanceSq(sx - s.sweepX, sy - s.sweepY, s.sweepX, s.sweepY,
+                                          cx, cy) < r * r;
+        }
+
+        // Swept box vs the circle's bounding box.
+        float hw = (s.maxX - s.minX) * 0.5f + radius;
+        float hh = (s.maxY - s.minY) * 0.5f + radius;
+
+        return segmentBox(sx - s.sweepX, sy - s.sweepY, s.sweepX, s.sweepY,
+                          cx - hw, cy - hh, cx + hw, cy + hh);
+    }
+
+    if (s.radius > 0.0f)
+        return circleCircle(cx, cy, radius, sx, sy, s.radius);
+
+    return circleBox(cx, cy, radius, s.minX, s.minY, s.maxX, s.maxY);
+}
+
+int SpacialPartition::column(float x) const
+{
+    // floor, not truncation, so coordinates just left of the grid don't land in column 0.
+    return int(std::floor((x - left) * invTileSize));
+}
+
+int SpacialPartition::row(float y) const
+{
+    return int(std::floor((y - top) * invTileSize));
+}
@@ -0,0 +1,207 @@
+#include <bulletlua/ThreadPool.hpp>
+
+#include <stdexcept>
+
+namespace
+{
+    // Pool whose jobs this thread is running, or nullptr.
+    thread_local const ThreadPool* running = nullptr;
+
+    // Marks this thread as running jobs of `pool` for a scope.
+    struct Running
+    {
+        const ThreadPool* previous;
+
+        explicit Running(const ThreadPool* pool)
+            : previous{running}
+        {
+            running = pool;
+        }
+
+        ~Running()
+        {
+            running = previous;
+        }
+    };
+}
+
+ThreadPool::ThreadPool(unsigned int workerCount)
+    : queues{},
+      workers{},
+      calls{},
+      job{nullptr},
+      generation{0},
+      stopping{false},
+      remaining{0},
+      error{}
+{
+    for (unsigned int i = 0; i <= workerCount; ++i)
+    {
+        queues.emplace_back(new Queue);
+    }
+
+    // Queue 0 belongs to the thread calling run().
+    for (unsigned int i = 1; i <= workerCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(unsigned int count, const Job& f)
+{
+    // It would wait for itself.
+    if (running == this)
+        throw std::logic_error{"ThreadPool: run() called from one of its own jobs"};
+
+    if (count == 0)
+        return;
+
+    Running scope{this};
+
+    if (workers.empty())
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            f(i);
+        }
+
+        return;
+    }
+
+    // The queues hold one batch at a time, so callers on other threads wait their turn.
+    std::lock_guard<std::mutex> turn{calls};
+
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        job = &f;
+        error = nullptr;
+        remaining = count;
+
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            Queue& queue = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> queueGuard{queue.lock};
+            queue.jobs.push_back(i);
+        }
+
+        ++generation;
+    }
+    wake.notify_all();
+
+    while (runOne(0))
+    {
+    }
+
+    std::exception_ptr failure;
+    {
+        std::unique_lock<std::mutex> guard{lock};
+        done.wait(guard, [this]() { return remaining == 0; });
+
+        job = nullptr;
+        failure = error;
+        error = nullptr;
+    }
+
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+unsigned int ThreadPool::size() const
+{
+    return queues.size();
+}
+
+unsigned int ThreadPool::defaultWorkers()
+{
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads > 1 ? threads - 1 : 0;
+}
+
+void ThreadPool::work(unsigned int self)
+{
+    Running scope{this};
+    unsigned int seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard{lock};
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+
+            if (stopping)
+                return;
+
+            seen = generation;
+        }
+
+        while (runOne(self))
+        {
+        }
+    }
+}
+
+bool ThreadPool::runOne(unsigned int self)
+{
+    unsigned int index = 0;
+    bool found = false;
+
+    // Own jobs from the front, stolen ones from the back.
+    for (unsigned int n = 0; n < queues.size() && !found; ++n)
+    {
+        Queue& queue = *queues[(self + n) % queues.size()];
+        std::lock_guard<std::mutex> guard{queue.lock};
+
+        if (queue.jobs.empty())
+            continue;
+
+        if (n == 0)
+        {
+            index = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        else
+        {
+            index = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+
+        found = true;
+    }
+
+    if (!found)
+        return false;
+
+    // `job` stays set until every job of this run is done.
+    try
+    {
+        (*job)(index);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        if (!error)
+            error = std::current_exception();
+    }
+
+    if (--remaining == 0)
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        done.notify_all();
+    }
+
+    return true;
+}
@@ -0,0 +1,97 @@
+#include <bulletlua/TimingWheel.hpp>
+
+TimingWheel::TimingWheel()
+    : level0(SLOTS),
+      level1(LEVEL_SLOTS),
+      level2(LEVEL_SLOTS),
+      overflow{},
+      frame{0},
+      count{0}
+{
+}
+
+void TimingWheel::schedule(BulletStore::Handle handle, unsigned int when)
+{
+    place(Entry{handle, when});
+    ++count;
+}
+
+void TimingWheel::advance(std::vector<BulletStore::Handle>& due)
+{
+    Slot& slot = level0[frame & (SLOTS - 1)];
+    for (const Entry& entry : slot)
+    {
+        due.push_back(entry.handle);
+    }
+    count -= slot.size();
+    slot.clear();
+
+    ++frame;
+
+    // Entering a new span of a coarser level: its slot for this span is now close enough to
+    // move down. Coarsest first, so entries can drop more than one level at once.
+    if ((frame & ((1u << OVERFLOW_SHIFT) - 1)) == 0)
+        cascade(overflow);
+
+    if ((frame & ((1u << LEVEL2_SHIFT) - 1)) == 0)
+        cascade(level2[(frame >> LEVEL2_SHIFT) & (LEVEL_SLOTS - 1)]);
+
+    if ((frame & ((1u << LEVEL1_SHIFT) - 1)) == 0)
+        cascade(level1[(frame >> LEVEL1_SHIFT) & (LEVEL_SLOTS - 1)]);
+}
+
+unsigned int TimingWheel::now() const
+{
+    return frame;
+}
+
+unsigned int TimingWheel::size() const
+{
+    return count;
+}
+
+void TimingWheel::clear()
+{
+    for (Slot& slot : level0)
+        slot.clear();
+    for (Slot& slot : level1)
+        slot.clear();
+    for (Slot& slot : level2)
+        slot.clear();
+    overflow.clear();
+
+    count = 0;
+}
+
+void TimingWheel::place(const Entry& entry)
+{
+    unsigned int delta = entry.when - frame;
+
+    if (delta < (1u << LEVEL1_SHIFT))
+        level0[entry.when & (SLOTS - 1)].push_back(entry);
+    else if (delta < (1u << LEVEL2_SHIFT))
+        level1[(entry.when >> LEVEL1_SHIFT) & (LEVEL_SLOTS - 1)].push_back(entry);
+    else if (delta < (1u << OVERFLOW_SHIFT))
+        level2[(entry.when >> LEVEL2_SHIFT) & (LEVEL_SLOTS - 1)].push_back(entry);
+    else
+        overflow.push_back(entry);
+}
+
+void TimingWheel::cascade(Slot& slot)
+{
+    // Entries may land back in `slot` itself (overflow), so work from a copy.
+    Slot entries;
+    entries.swap(slot);
+
+    for (const Entry& entry : entries)
+    {
+        place(entry);
+    }
+
+    // Keep the slot's storage for next time.
+    if (slot.empty())
+    {
+        entries.clear();
+        slot.swap(entries);
+    }
+}
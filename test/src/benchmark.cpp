@@ -0,0 +1,422 @@
+#include <catch.hpp>
+
+#include <bulletlua/Behavior.hpp>
+#include <bulletlua/BulletLuaApi.hpp>
+#include <bulletlua/BulletLuaManager.hpp>
+#include <bulletlua/Bullet.hpp>
+#include <bulletlua/BulletStore.hpp>
+#include <bulletlua/SimulationHost.hpp>
+#include <bulletlua/Snapshot.hpp>
+#include <bulletlua/SpacialPartition.hpp>
+#include <bulletlua/ThreadPool.hpp>
+#include <bulletlua/Utils/Rect.hpp>
+#include <bulletlua/Utils/Rng.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Benchmarks are hidden; run them with `bltest [benchmark]`.
+
+namespace
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // The fixed-capacity grid SpacialPartition used before the CSR build, kept as a baseline.
+    struct FixedGrid
+    {
+        static constexpr int TILE = 50;
+        static constexpr int WIDTH = 640 / TILE;
+        static constexpr int HEIGHT = 480 / TILE;
+        static constexpr int CAP = 100;
+
+        unsigned int space[WIDTH][HEIGHT][CAP];
+        int count[WIDTH][HEIGHT];
+        unsigned int dropped;
+
+        void build(const BulletStore& bullets)
+        {
+            std::memset(count, 0, sizeof(count));
+            dropped = 0;
+
+            for (unsigned int i = 0; i < bullets.size(); ++i)
+            {
+                int x = bullets.x[i] / TILE;
+                int y = bullets.y[i] / TILE;
+
+                if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
+                    continue;
+
+                if (count[x][y] < CAP)
+                    space[x][y][count[x][y]++] = i;
+                else
+                    ++dropped;
+            }
+        }
+    };
+
+    void fill(BulletStore& bullets, unsigned int n, float spread)
+    {
+        BulletLuaUtils::MTRandom rng{42};
+
+        bullets.clear();
+        bullets.reserve(n);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            // Cluster around the center to mimic a dense aimed stream.
+            bullets.add(320.0f + rng.floatRange(-spread, spread),
+                        240.0f + rng.floatRange(-spread, spread),
+                        0.0f, 0.0f);
+        }
+    }
+
+    // Exposes both ways of spawning a burst from one parent bullet.
+    class Burster : public BulletLuaManager
+    {
+        public:
+            std::shared_ptr<sol::state> lua;
+            sol::function child;
+            ScriptTable::Id childId;
+
+            explicit Burster(const BulletLuaUtils::Rect& player)
+                : BulletLuaManager{0, 0, 640, 480, player},
+                  lua{states.acquire()}
+            {
+                Bullet origin{320.0f, 120.0f, 0.0f, 0.0f};
+                lua->script("function main(b) b:stop() end function child(b) end");
+                startRoot(lua, &origin);
+
+                child = lua->get<sol::function>("child");
+
+                child.push();
+                childId = scriptTable.function(bullets.scripts[0].state, lua->lua_state(), -1);
+                scriptTable.retainFunction(childId);
+                lua_pop(lua->lua_state(), 1);
+            }
+
+            // One createBullet per bullet, like fireCircle used to do.
+            void one(unsigned int count)
+            {
+                for (unsigned int i = 0; i < count; ++i)
+                {
+                    createBullet(lua, child, bullets.x[0], bullets.y[0], 0.1f * i, 2.0f);
+                }
+            }
+
+            void batch(unsigned int count)
+            {
+                // Centered where one() puts its 4x4 bullets.
+                fireBatch(Spawn{bullets.x[0] + 2.0f, bullets.y[0] + 2.0f, 0.0f, 0.1f, 2.0f, 0.0f,
+                                count, bullets.scripts[0].state, childId, 0, ENEMY_BULLETS,
+                                4.0f, 4.0f, 0.0f, 255, 255, 255});
+            }
+
+            // Drop every bullet but the root.
+            void reset()
+            {
+                for (unsigned int i = 1; i < bullets.size(); ++i)
+                    bullets.kill(i);
+
+                removeDead();
+                active.clear();
+            }
+    };
+
+    // Bullets spread over a few behaviors, interleaved the way overlapping bursts are.
+    class Mover : public BulletLuaManager
+    {
+        public:
+            explicit Mover(const BulletLuaUtils::Rect& player)
+                : BulletLuaManager{0, 0, 640, 480, player}
+            {
+            }
+
+            void fill(unsigned int n)
+            {
+                Behavior kinds[6];
+                kinds[0].turn = 0.02f;
+                kinds[1].accel = 0.01f;
+                kinds[1].maxSpeed = 3.0f;
+                kinds[2].amplitude = 0.5f;
+                kinds[2].period = 60.0f;
+                kinds[3].homing = 0.03f;
+                kinds[4].orbit = 0.01f;
+                kinds[4].orbitX = 320.0f;
+                kinds[4].orbitY = 240.0f;
+                kinds[5].turn = -0.01f;
+                kinds[5].accel = -0.01f;
+                kinds[5].minSpeed = 1.0f;
+
+                unsigned short ids[6];
+                for (unsigned int k = 0; k < 6; ++k)
+                    ids[k] = internBehavior(kinds[k], n);
+
+                BulletLuaUtils::MTRandom rng{42};
+                bullets.reserve(n);
+                for (unsigned int i = 0; i < n; ++i)
+                {
+                    unsigned int b = bullets.add(rng.floatRange(0.0f, 640.0f),
+                                                 rng.floatRange(0.0f, 480.0f), 1.0f, 1.0f);
+                    bullets.behavior[b] = ids[rng.int_64(0, 5)];
+                }
+            }
+
+            // How runBehaviors used to work: one pass in store order, dispatching per bullet.
+            void perBullet()
+            {
+                for (unsigned int i = 0; i < bullets.size(); ++i)
+                {
+                    unsigned short id = bullets.behavior[i];
+                    if (id == 0 || bullets.isDead(i))
+                        continue;
+
+                    const Behavior& behavior = behaviors[id];
+
+                    float tx = 0.0f;
+                    float ty = 0.0f;
+                    if (behavior.homing != 0.0f)
+                    {
+                        const BulletLuaUtils::Rect& target = nearestTarget(i);
+                        tx = target.getCenterX();
+                        ty = target.getCenterY();
+                    }
+
+                    behavior.apply(bullets, &i, 1, &tx, &ty);
+                }
+            }
+
+            void batched()
+            {
+                runBehaviors();
+            }
+
+            const BulletStore& store() const
+            {
+                return bullets;
+            }
+    };
+
+    template <typename F>
+    double averageMicroseconds(int iterations, F f)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            f();
+        auto end = Clock::now();
+
+        return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+    }
+}
+
+TEST_CASE("Grid Build", "[.][benchmark]")
+{
+    const int iterations = 200;
+    ThreadPool pool;
+
+    for (unsigned int n : {1000u, 10000u, 100000u})
+    {
+        BulletStore bullets;
+        fill(bullets, n, 200.0f);
+
+        SpacialPartition grid{bullets, BulletLuaUtils::Rect{0.0f, 0.0f, 640.0f, 480.0f}};
+        std::unique_ptr<FixedGrid> fixed{new FixedGrid};
+
+        double csr = averageMicroseconds(iterations, [&]() { grid.build(); });
+        double array = averageMicroseconds(iterations, [&]() { fixed->build(bullets); });
+
+        grid.setThreadPool(&pool);
+        double parallel = averageMicroseconds(iterations, [&]() { grid.build(); });
+
+        std::cout << n << " bullets: CSR " << csr << "us (" << grid.entryCount() << " entries), "
+                  << "CSR on " << pool.size() << " threads " << parallel << "us, "
+                  << "fixed array " << array << "us (" << fixed->dropped << " dropped)"
+                  << std::endl;
+
+        // Bullets straddling tile borders are binned more than once.
+        REQUIRE(grid.entryCount() >= n);
+    }
+}
+
+TEST_CASE("Snapshot Publish", "[.][benchmark]")
+{
+    const int iterations = 200;
+
+    for (unsigned int n : {1000u, 10000u, 100000u})
+    {
+        BulletStore bullets;
+        fill(bullets, n, 200.0f);
+
+        SnapshotBuffer buffer;
+        unsigned int frame = 0;
+
+        double publish = averageMicroseconds(iterations, [&]()
+        {
+            buffer.back().capture(bullets, ++frame);
+            buffer.publish();
+        });
+
+        std::cout << n << " bullets: capture and publish " << publish << "us" << std::endl;
+
+        REQUIRE(buffer.update() == true);
+        REQUIRE(buffer.front().size() == n);
+    }
+}
+
+TEST_CASE("Root Bullet Setup", "[.][benchmark]")
+{
+    const int iterations = 2000;
+
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletLuaManager manager{0, 0, 640, 480, player};
+    Bullet origin{320.0f, 120.0f, 0.0f, 0.0f};
+
+    // How initLua used to bind the API: one sol::state::set_function per function.
+    double perFunction = averageMicroseconds(iterations, [&]()
+    {
+        sol::state lua;
+        lua.open_libraries(sol::lib::base);
+        lua.open_libraries(sol::lib::math);
+        lua.open_libraries(sol::lib::table);
+
+        for (int f = 0; f < 39; ++f)
+        {
+            lua.set_function("f" + std::to_string(f), [&]() { return manager.bulletCount(); });
+        }
+    });
+
+    double shared = averageMicroseconds(iterations, [&]()
+    {
+        sol::state lua;
+        lua.open_libraries(sol::lib::base);
+        lua.open_libraries(sol::lib::math);
+        lua.open_libraries(sol::lib::table);
+
+        BulletLuaApi::open(lua.lua_state(), &manager);
+    });
+
+    // Everything a launch pays for, including compiling the script.
+    double root = averageMicroseconds(iterations, [&]()
+    {
+        manager.createBulletFromScript("function main(b) end ", &origin);
+        manager.clear();
+    });
+
+    std::cout << "State with per-function bindings " << perFunction << "us, "
+              << "with the shared API table " << shared << "us, "
+              << "full root bullet " << root << "us" << std::endl;
+
+    REQUIRE(manager.bulletCount() == 0);
+}
+
+TEST_CASE("Bulk Spawn", "[.][benchmark]")
+{
+    const int iterations = 2000;
+    const unsigned int count = 500;
+
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    Burster manager{player};
+
+    double one = averageMicroseconds(iterations, [&]() { manager.one(count); manager.reset(); });
+    double batch = averageMicroseconds(iterations, [&]() { manager.batch(count); manager.reset(); });
+
+    std::cout << count << "-bullet burst: one spawn at a time " << one << "us, "
+              << "batched " << batch << "us (including cleanup)" << std::endl;
+
+    REQUIRE(manager.bulletCount() == 1);
+}
+
+TEST_CASE("Parallel Tick", "[.][benchmark]")
+{
+    const int iterations = 200;
+
+    // An 8-pattern boss whose scripts do real work every frame.
+    const char* script =
+        "function child(b) b:setDirectionRelative(math.sin(b:getTurn() / 10)) end "
+        "function main(b) "
+        "    local sum = 0 "
+        "    for i = 1, 2000 do sum = sum + math.sqrt(i) end "
+        "    if b:getTurn() % 20 == 0 then b:fireCircle(16, 1, child) end "
+        "end ";
+
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    ThreadPool pool;
+
+    double times[2];
+    for (int parallel = 0; parallel < 2; ++parallel)
+    {
+        BulletLuaManager manager{0, 0, 640, 480, player};
+        if (parallel)
+            manager.setThreadPool(&pool);
+
+        for (int p = 0; p < 8; ++p)
+        {
+            Bullet origin{80.0f + 60.0f * p, 120.0f, 0.0f, 0.0f};
+            manager.createBulletFromScript(script, &origin);
+        }
+
+        times[parallel] = averageMicroseconds(iterations, [&]() { manager.tick(); });
+    }
+
+    std::cout << "8 patterns: serial tick " << times[0] << "us, parallel tick on "
+              << pool.size() << " threads " << times[1] << "us" << std::endl;
+}
+
+TEST_CASE("Simulation Host", "[.][benchmark]")
+{
+    const unsigned int instances = 16;
+    const unsigned int frames = 300;
+
+    // A stage that keeps a few hundred bullets alive.
+    const char* script =
+        "function child(b) b:setDirectionRelative(math.sin(b:getTurn() / 10)) end "
+        "function main(b) "
+        "    if b:getTurn() % 10 == 0 then b:fireCircle(24, b:randFloatRange(1, 2), child) end "
+        "end ";
+
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+
+    for (unsigned int workers : {0u, ThreadPool::defaultWorkers()})
+    {
+        SimulationHost host{workers};
+        host.preloadScript(script);
+
+        for (unsigned int i = 0; i < instances; ++i)
+        {
+            host.add(0, 0, 640, 480, player, i);
+
+            Bullet origin{320.0f, 120.0f, 0.0f, 0.0f};
+            host.manager(i).createBulletFromScript(script, &origin);
+        }
+
+        host.advance(frames);
+
+        std::cout << instances << " instances on " << host.threadCount() << " threads: "
+                  << host.ticksPerSecond() << " ticks/s" << std::endl;
+
+        REQUIRE(host.totalTicks() == instances * frames);
+    }
+}
+
+TEST_CASE("Behaviors", "[.][benchmark]")
+{
+    const int iterations = 200;
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+
+    for (unsigned int n : {1000u, 10000u, 100000u})
+    {
+        Mover a{player};
+        Mover b{player};
+        a.fill(n);
+        b.fill(n);
+
+        double perBullet = averageMicroseconds(iterations, [&]() { a.perBullet(); });
+        double batched = averageMicroseconds(iterations, [&]() { b.batched(); });
+
+        std::cout << n << " bullets, 6 behaviors: per bullet " << perBullet << "us, "
+                  << "per behavior " << batched << "us" << std::endl;
+
+        // Both orders compute the same thing.
+        REQUIRE(a.store().vx == b.store().vx);
+    }
+}
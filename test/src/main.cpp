@@ -1,11 +1,52 @@
 #include <catch.hpp>
 
 #include <bulletlua/BulletLuaManager.hpp>
-#include <bulletlua/BulletLua.hpp>
+#include <bulletlua/ChunkCache.hpp>
+#include <bulletlua/SimulationHost.hpp>
+#include <bulletlua/Snapshot.hpp>
+#include <bulletlua/SpacialPartition.hpp>
+#include <bulletlua/ThreadPool.hpp>
+#include <bulletlua/TimingWheel.hpp>
+#include <bulletlua/Bullet.hpp>
+#include <bulletlua/Utils/Math.hpp>
 #include <bulletlua/Utils/Rect.hpp>
+#include <bulletlua/Utils/Rng.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <iostream>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // Counts every trip through the global allocator so tests can check for hidden allocations.
+    unsigned long allocationCount = 0;
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocationCount;
+
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw std::bad_alloc{};
+
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
 
 class BulletTester : public BulletLuaManager
 {
@@ -19,10 +60,47 @@ class BulletTester : public BulletLuaManager
         {
         }
 
+        const BulletStore& store() const
+        {
+            return bullets;
+        }
+
         void createEmptyBullet()
         {
-            BulletLua* b = getFreeBullet();
-            bullets.push_back(b);
+            getFreeBullet();
+        }
+
+        // Distinct behaviors in use.
+        unsigned int behaviorCount() const
+        {
+            return behaviorIds.size();
+        }
+
+        // Entries of the behavior table, used or free.
+        unsigned int behaviorSlots() const
+        {
+            return behaviors.size();
+        }
+
+        const ScriptTable& scriptIds() const
+        {
+            return scriptTable;
+        }
+
+        lua_State* luaStateOf(unsigned int i) const
+        {
+            return scriptTable.luaState(bullets.scripts[i].state);
+        }
+
+        // Bullets whose scripts run next tick, not counting ones whose wait ends then.
+        unsigned int awakeCount() const
+        {
+            return active.size();
+        }
+
+        float tileSize(CollisionLayer layer) const
+        {
+            return layers[layer]->getTileSize();
         }
 
         void createEmptyBullets(unsigned int n)
@@ -83,69 +161,1605 @@ TEST_CASE("Space Allocation", "[Space]")
         REQUIRE(manager.freeCount() == expected_blocks * BLOCK_SIZE - a_lot);
         REQUIRE(manager.blockCount() == expected_blocks);
     }
+
+    // Spawning and killing bullets within a block's worth of capacity must not allocate.
+    SECTION("Steady state")
+    {
+        const char* script =
+            "function main()"
+            "    fire(180, 1, child)"
+            "end "
+            "function child()"
+            "    if (getTurn() == 10) then kill() end "
+            "end";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        // Let the population stabilize.
+        for (int i = 0; i < 20; ++i)
+            manager.tick();
+
+        unsigned int population = manager.bulletCount();
+        unsigned long before = allocationCount;
+
+        for (int i = 0; i < 100; ++i)
+            manager.tick();
+
+        REQUIRE(allocationCount == before);
+        REQUIRE(manager.bulletCount() == population);
+        REQUIRE(manager.blockCount() == 1);
+    }
 }
 
-TEST_CASE("Out of Bounds Check", "[Boundary]")
+TEST_CASE("Bullet Handles", "[Space]")
 {
     BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
     BulletTester manager{player};
 
     const char* script =
         "function main()"
-        "    setPosition(-4, 0)"
+        "    kill()"
         "end";
 
-    SECTION("Single Bullet")
+    SECTION("Stale handles")
+    {
+        BulletStore::Handle h = manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(manager.isAlive(h));
+
+        manager.tick();
+        REQUIRE_FALSE(manager.isAlive(h));
+
+        // Acting on a stale handle does nothing.
+        manager.vanish(h);
+        manager.kill(h);
+
+        // The slot is reused, but the old handle must not resolve to the new bullet.
+        BulletStore::Handle h2 = manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(h2 != h);
+        REQUIRE(manager.isAlive(h2));
+        REQUIRE_FALSE(manager.isAlive(h));
+    }
+
+    SECTION("Handles survive removal of other bullets")
+    {
+        BulletStore::Handle doomed = manager.createBulletFromScript(script, manager.origin.get());
+        BulletStore::Handle survivor = manager.createBulletFromScript("function main() end",
+                                                                      manager.origin.get());
+        REQUIRE(manager.isAlive(doomed));
+
+        manager.tick();
+
+        // `survivor` was swapped into `doomed`'s index.
+        REQUIRE_FALSE(manager.isAlive(doomed));
+        REQUIRE(manager.isAlive(survivor));
+        REQUIRE(manager.bulletCount() == 1);
+    }
+
+    SECTION("Stale handles stay stale until their generation wraps")
+    {
+        BulletStore bullets;
+        BulletStore::Handle first = bullets.handles[bullets.add(0.0f, 0.0f, 0.0f, 0.0f)];
+        bullets.remove(0);
+
+        // One slot, reused until every other generation has been handed out.
+        for (int n = 0; n < 1023; ++n)
+        {
+            BulletStore::Handle h = bullets.handles[bullets.add(0.0f, 0.0f, 0.0f, 0.0f)];
+            REQUIRE(h != first);
+            REQUIRE_FALSE(bullets.isValid(first));
+            bullets.remove(0);
+        }
+    }
+
+    SECTION("Slots are recycled through many generations")
+    {
+        BulletStore bullets;
+        bullets.reserve(16);
+
+        // Far more spawn/kill cycles per slot than there are generations.
+        for (int n = 0; n < 3000; ++n)
+        {
+            for (int i = 0; i < 16; ++i)
+                bullets.add(0.0f, 0.0f, 0.0f, 0.0f);
+
+            for (int i = 0; i < 16; ++i)
+                REQUIRE(bullets.indexOf(bullets.handles[i]) == (unsigned int)i);
+
+            bullets.clear();
+        }
+
+        REQUIRE(bullets.slotCount() == 16);
+    }
+}
+
+TEST_CASE("Bullet Objects", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("Methods act on the bullet passed in")
+    {
+        manager.createBulletFromScript("function main(b) b:setPosition(100, 100) b:setVelocity(2, 0) end ",
+                                       manager.origin.get());
+        manager.tick();
+
+        // A 4x4 box centered on (100, 100), then moved 2 to the right.
+        REQUIRE(manager.store().x[0] == Approx(100.0f));
+        REQUIRE(manager.store().vx[0] == Approx(2.0f));
+    }
+
+    SECTION("Children receive their own bullet")
+    {
+        const char* script =
+            "function child(b) b:setSpeed(3) end "
+            "function main(b) "
+            "    if b:getTurn() == 0 then b:fire(0, 1, child) end "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.bulletCount() == 2);
+        REQUIRE(manager.store().getSpeed(0) == Approx(0.0f));
+        REQUIRE(manager.store().getSpeed(1) == Approx(3.0f));
+    }
+
+    SECTION("Stored bullets outlive their owner safely")
     {
+        const char* script =
+            "function child(b) if b:getTurn() > 0 then parent:setSpeed(5) end end "
+            "function main(b) "
+            "    parent = b "
+            "    b:fire(0, 1, child) "
+            "    b:kill() "
+            "end ";
+
         manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+        manager.tick();
+
+        // The parent is gone; its stale object did nothing.
         REQUIRE(manager.bulletCount() == 1);
+        REQUIRE(manager.store().getSpeed(0) == Approx(1.0f));
+    }
+}
+
+TEST_CASE("Coroutines", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("wait and waitUntil")
+    {
+        const char* script =
+            "function main(b) "
+            "    b:setSpeed(1) "
+            "    wait(10) "
+            "    b:setSpeed(2) "
+            "    waitUntil(30) "
+            "    b:setSpeed(3) "
+            "    wait(1000) "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 10; ++i)
+            manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(1.0f));
 
         manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(2.0f));
+        REQUIRE(manager.store().turn[0] == 11);
 
-        REQUIRE(manager.bulletCount() == 0);
+        for (int i = 0; i < 20; ++i)
+            manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(3.0f));
+    }
+
+    SECTION("Sleeping bullets aren't called, finished functions start over")
+    {
+        const char* script =
+            "calls = 0 "
+            "function main(b) "
+            "    calls = calls + 1 "
+            "    b:setSpeed(calls) "
+            "    b:wait(5) "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 11; ++i)
+            manager.tick();
+
+        // Frames 0, 5 and 10.
+        REQUIRE(manager.store().getSpeed(0) == Approx(3.0f));
+    }
+
+    SECTION("Return values don't pile up on reused coroutines")
+    {
+        const char* script =
+            "function main(b) "
+            "    co = coroutine.running() "
+            "    return 1, 2, 3 "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 10; ++i)
+            manager.tick();
+
+        lua_State* L = manager.luaStateOf(0);
+        lua_getglobal(L, "co");
+        lua_State* co = lua_tothread(L, -1);
+        lua_pop(L, 1);
+
+        REQUIRE(co != nullptr);
+        REQUIRE(lua_gettop(co) == 0);
     }
 }
 
-TEST_CASE("Collision Check", "[Collision]")
+TEST_CASE("Timing Wheel", "[Lua]")
+{
+    TimingWheel wheel;
+    std::vector<BulletStore::Handle> due;
+
+    // One bullet per level, the overflow list, and both sides of each level boundary.
+    const unsigned int whens[] = {1, 255, 256, 300, 16383, 16384, 20000, (1u << 20) - 1,
+                                  (1u << 20) + 5};
+    const unsigned int n = sizeof(whens) / sizeof(whens[0]);
+
+    for (unsigned int i = 0; i < n; ++i)
+        wheel.schedule(i, whens[i]);
+    REQUIRE(wheel.size() == n);
+
+    unsigned int found = 0;
+    while (wheel.size() > 0)
+    {
+        unsigned int frame = wheel.now();
+
+        due.clear();
+        wheel.advance(due);
+
+        for (BulletStore::Handle h : due)
+        {
+            REQUIRE(whens[h] == frame);
+            ++found;
+        }
+    }
+
+    REQUIRE(found == n);
+}
+
+TEST_CASE("Script Scheduling", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("Stopped bullets keep flying without lua calls")
+    {
+        const char* script =
+            "calls = 0 "
+            "function child(b) calls = calls + 1 b:stop() end "
+            "function main(b) "
+            "    if b:getTurn() == 0 then "
+            "        b:fireCircle(8, 1, child) "
+            "        b:fireCircle(8, 1, nullfunc) "
+            "    end "
+            "    b:setColor(calls, 0, 0) "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 5; ++i)
+            manager.tick();
+
+        REQUIRE(manager.bulletCount() == 17);
+        REQUIRE(manager.awakeCount() == 1);
+        REQUIRE(manager.store().r[0] == 8);
+
+        // Still moving.
+        REQUIRE(manager.store().turn[1] == 5);
+        REQUIRE(manager.store().getSpeed(1) == Approx(1.0f));
+    }
+
+    SECTION("setFunction restarts a stopped bullet")
+    {
+        const char* script =
+            "function moved(b) b:setColor(0, 9, 0) end "
+            "function sleeper(b) kid = b b:stop() end "
+            "function main(b) "
+            "    if b:getTurn() == 0 then b:fire(0, 0, sleeper) end "
+            "    if b:getTurn() == 3 then kid:setFunction(moved) end "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 3; ++i)
+            manager.tick();
+        REQUIRE(manager.awakeCount() == 1);
+
+        // Frame 3 restarts it, frame 4 runs it.
+        manager.tick();
+        REQUIRE(manager.awakeCount() == 2);
+
+        manager.tick();
+        REQUIRE(manager.store().g[1] == 9);
+    }
+
+    SECTION("Long waits")
+    {
+        const char* script =
+            "function main(b) "
+            "    wait(300) "
+            "    b:setColor(1, 0, 0) "
+            "    wait(20000) "
+            "    b:setColor(2, 0, 0) "
+            "    b:stop() "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        for (int i = 0; i < 300; ++i)
+            manager.tick();
+        REQUIRE(manager.store().r[0] == 255);
+        REQUIRE(manager.awakeCount() == 0);
+
+        manager.tick();
+        REQUIRE(manager.store().r[0] == 1);
+
+        for (int i = 0; i < 20000; ++i)
+            manager.tick();
+        REQUIRE(manager.store().r[0] == 2);
+        REQUIRE(manager.awakeCount() == 0);
+    }
+}
+
+TEST_CASE("Bulk Spawn", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("A whole burst is reserved at once")
+    {
+        manager.createBulletFromScript("function main(b) b:fireCircle(3000, 1, nullfunc) b:kill() end",
+                                       manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.bulletCount() == 3000);
+        REQUIRE(manager.blockCount() == 2);
+        REQUIRE(manager.freeCount() > 0);
+
+        // nullfunc children never run.
+        REQUIRE(manager.awakeCount() == 0);
+    }
+
+    SECTION("Bursts larger than a block count every block they reserve")
+    {
+        manager.createBulletFromScript("function main(b) b:fireCircle(10000, 1, nullfunc) b:kill() end",
+                                       manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.bulletCount() == 10000);
+        REQUIRE(manager.blockCount() == 5);
+        REQUIRE(manager.freeCount() == 5 * BLOCK_SIZE - 10000);
+    }
+
+    SECTION("Children leave from their parent's center")
+    {
+        manager.createBulletFromScript("function main(b) b:setHitbox(40, 20) b:fire(0, 0, nullfunc) b:stop() end",
+                                       manager.origin.get());
+        manager.tick();
+
+        const BulletStore& bullets = manager.store();
+        REQUIRE(bullets.getRect(1).getCenterX() == Approx(bullets.getRect(0).getCenterX()));
+        REQUIRE(bullets.getRect(1).getCenterY() == Approx(bullets.getRect(0).getCenterY()));
+        REQUIRE(bullets.w[1] == Approx(BulletStore::DEFAULT_SIZE));
+    }
+
+    SECTION("Spreads fan out around their direction")
+    {
+        manager.createBulletFromScript("function main(b) "
+                                       "    b:fire(90, 2, nullfunc) "
+                                       "    b:fireSpread(5, 90, 60, 2, nullfunc) "
+                                       "    b:fireArc(3, 60, 120, 2, nullfunc) "
+                                       "    b:stop() "
+                                       "end ",
+                                       manager.origin.get());
+        manager.tick();
+
+        const BulletStore& bullets = manager.store();
+        REQUIRE(manager.bulletCount() == 10);
+
+        float center = bullets.getDirection(1);
+        REQUIRE(bullets.getDirection(4) == Approx(center));
+        REQUIRE(bullets.getDirection(8) == Approx(center));
+        REQUIRE(bullets.getDirection(2) == Approx(bullets.getDirection(7)));
+        REQUIRE(bullets.getDirection(6) == Approx(bullets.getDirection(9)));
+        REQUIRE(bullets.getDirection(3) - bullets.getDirection(2) ==
+                Approx(bullets.getDirection(4) - bullets.getDirection(3)));
+
+        for (unsigned int i = 1; i < 10; ++i)
+            REQUIRE(bullets.getSpeed(i) == Approx(2.0f));
+    }
+
+    SECTION("Stacks ramp their speed")
+    {
+        const char* script =
+            "function child(b) b:setColor(1, 2, 3) b:stop() end "
+            "function main(b) b:fireStack(4, 90, 1, 0.5, child) b:stop() end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+
+        const BulletStore& bullets = manager.store();
+        REQUIRE(manager.bulletCount() == 5);
+
+        for (unsigned int i = 1; i < 5; ++i)
+        {
+            REQUIRE(bullets.getSpeed(i) == Approx(1.0f + 0.5f * (i - 1)));
+            REQUIRE(bullets.getDirection(i) == Approx(bullets.getDirection(1)));
+
+            // Every child ran the shared function in its first frame.
+            REQUIRE(bullets.g[i] == 2);
+        }
+    }
+}
+
+TEST_CASE("Spawn Timing", "[Lua]")
 {
     BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
     BulletTester manager{player};
 
     const char* script =
-        "function main()"
-        "    setPosition(100, 100)"
-        "end";
+        "function child(b) b:setColor(0, 0, 0) b:stop() end "
+        "function main(b) b:fire(90, 2, child) b:fire(180, 2, child) b:stop() end ";
 
-    SECTION("Single Bullet")
+    SECTION("Same frame")
     {
-        // Create a bullet, script will move it to (100, 100)
         manager.createBulletFromScript(script, manager.origin.get());
         manager.tick();
 
-        // Move our "ship" to (100, 100) as well.
-        player.setCenter(100.0f, 100.0f);
+        // Added in the order they were fired, and already ran.
+        REQUIRE(manager.bulletCount() == 3);
+        REQUIRE(manager.store().getDirection(1) == Approx(Math::degToRad(90.0f)));
+        REQUIRE(manager.store().r[1] == 0);
+        REQUIRE(manager.store().r[2] == 0);
+    }
 
-        // std::cout << player.x << " " << player.y << " " << player.w << " " << player.h << std::endl;
+    SECTION("Next frame")
+    {
+        manager.setSpawnTiming(BulletLuaManager::NEXT_FRAME);
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
 
-        // Is there a collision? There better be.
-        REQUIRE(manager.checkCollision() == true);
+        // Moving, but their scripts haven't run yet.
+        REQUIRE(manager.bulletCount() == 3);
+        REQUIRE(manager.store().turn[1] == 1);
+        REQUIRE(manager.store().r[1] == 255);
+        REQUIRE(manager.awakeCount() == 2);
 
-        // Offset by one. Since our "ship" is 4 units wide and 4 units tall, this should still be
-        // considered a collision.
-        player.setCenter(99.0f, 99.0f);
-        REQUIRE(manager.checkCollision() == true);
+        manager.tick();
+        REQUIRE(manager.store().r[1] == 0);
+        REQUIRE(manager.store().r[2] == 0);
+        REQUIRE(manager.awakeCount() == 0);
+    }
+}
 
-        player.setCenter(101.0f, 99.0f);
-        REQUIRE(manager.checkCollision() == true);
+TEST_CASE("Interned Scripts", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+    const ScriptTable& ids = manager.scriptIds();
 
-        player.setCenter(101.0f, 101.0f);
-        REQUIRE(manager.checkCollision() == true);
+    SECTION("Children share one function and their parent's state")
+    {
+        const char* script =
+            "function child(b) wait(2) b:kill() end "
+            "function main(b) "
+            "    if b:getTurn() == 0 then "
+            "        b:fireCircle(50, 1, child) "
+            "        b:fire(0, 1, child) "
+            "    end "
+            "end ";
 
-        player.setCenter(99.0f, 101.0f);
-        REQUIRE(manager.checkCollision() == true);
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
 
-        // // No longer a collision.
-        // player.setCenter(102.0f, 102.0f);
-        // REQUIRE(manager.checkCollision() == false);
+        REQUIRE(manager.bulletCount() == 52);
+        REQUIRE(ids.functionCount() == 2);
+        REQUIRE(ids.stateCount() == 1);
+        REQUIRE(manager.store().scripts[1].function == manager.store().scripts[51].function);
+
+        for (int i = 0; i < 3; ++i)
+            manager.tick();
+
+        // The last child gave `child` back.
+        REQUIRE(manager.bulletCount() == 1);
+        REQUIRE(ids.functionCount() == 1);
+    }
+
+    SECTION("States go back once nothing uses them")
+    {
+        manager.createBulletFromScript("function child(b) wait(1000) end "
+                                       "function main(b) b:fireCircle(8, 1, child) b:stop() end ",
+                                       manager.origin.get());
+        manager.tick();
+        REQUIRE(manager.idleStateCount() == 0);
+
+        // Parked children hold their coroutines until they are removed.
+        manager.clear();
+        REQUIRE(ids.functionCount() == 0);
+        REQUIRE(ids.stateCount() == 0);
+        REQUIRE(manager.idleStateCount() == 1);
+    }
+
+    SECTION("Scripts without main don't keep their state")
+    {
+        REQUIRE_THROWS(manager.createBulletFromScript("main = 1", manager.origin.get()));
+        REQUIRE(ids.stateCount() == 0);
+        REQUIRE(manager.idleStateCount() == 1);
+    }
+}
+
+TEST_CASE("Thread Pool", "[Parallel]")
+{
+    for (unsigned int workers : {0u, 3u})
+    {
+        ThreadPool pool{workers};
+        REQUIRE(pool.size() == workers + 1);
+
+        std::vector<int> hits(100, 0);
+        pool.run(hits.size(), [&](unsigned int i) { hits[i] += 1; });
+        REQUIRE(std::count(hits.begin(), hits.end(), 1) == 100);
+
+        std::atomic<int> finished{0};
+        ThreadPool::Job failing = [&](unsigned int i)
+        {
+            if (i == 3)
+                throw std::runtime_error{"job failed"};
+            ++finished;
+        };
+        REQUIRE_THROWS_AS(pool.run(10, failing), std::runtime_error);
+
+        // The other jobs still ran.
+        REQUIRE(finished == 9);
+
+        // A job can't wait for its own pool.
+        ThreadPool::Job nested = [&](unsigned int) { pool.run(1, [](unsigned int) {}); };
+        REQUIRE_THROWS_AS(pool.run(4, nested), std::logic_error);
+
+        // Callers on different threads take turns.
+        std::vector<std::vector<int>> shared(4, std::vector<int>(1000, 0));
+        std::vector<std::thread> callers;
+        for (std::vector<int>& counts : shared)
+        {
+            callers.emplace_back([&pool, &counts]()
+            {
+                for (int n = 0; n < 20; ++n)
+                    pool.run(counts.size(), [&counts](unsigned int i) { counts[i] += 1; });
+            });
+        }
+        for (std::thread& caller : callers)
+            caller.join();
+
+        for (const std::vector<int>& counts : shared)
+            REQUIRE(std::count(counts.begin(), counts.end(), 20) == 1000);
+    }
+}
+
+TEST_CASE("Parallel Tick", "[Parallel]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+
+    // Declared first so it outlives the managers.
+    ThreadPool serial{0};
+    ThreadPool pool{3};
+
+    BulletTester a{player};
+    BulletTester b{player};
+
+    auto launch = [&](BulletTester& manager, const char* script)
+    {
+        for (int p = 0; p < 6; ++p)
+        {
+            Bullet origin{100.0f + 80.0f * p, 120.0f, 0.0f, 0.0f};
+            manager.createBulletFromScript(script, &origin);
+        }
+    };
+
+    SECTION("Results don't depend on the number of threads")
+    {
+        const char* script =
+            "function child(b) "
+            "    wait(b:randInt(20)) "
+            "    b:aimTarget() "
+            "    b:setSpeed(b:randFloatRange(1, 3)) "
+            "    wait(1000) "
+            "end "
+            "function main(b) "
+            "    b:fireSpread(3, b:randFloatRange(0, 360), 40, 1.5, child) "
+            "    wait(4) "
+            "end ";
+
+        a.setThreadPool(&serial);
+        b.setThreadPool(&pool);
+        launch(a, script);
+        launch(b, script);
+
+        for (int f = 0; f < 60; ++f)
+        {
+            a.tick();
+            b.tick();
+
+            REQUIRE(a.bulletCount() == b.bulletCount());
+            for (unsigned int i = 0; i < a.bulletCount(); ++i)
+            {
+                REQUIRE(a.store().x[i] == b.store().x[i]);
+                REQUIRE(a.store().y[i] == b.store().y[i]);
+            }
+        }
+
+        REQUIRE(a.bulletCount() > 6);
+    }
+
+    SECTION("Patterns without randomness match a serial tick")
+    {
+        const char* script =
+            "function child(b) b:setDirectionRelative(3) end "
+            "function main(b) "
+            "    if b:getTurn() % 10 == 0 then b:fireCircle(12, 2, child) end "
+            "end ";
+
+        b.setThreadPool(&pool);
+        launch(a, script);
+        launch(b, script);
+
+        // Only the order of the bullets may differ.
+        auto positions = [](const BulletStore& bullets)
+        {
+            std::vector<std::pair<float, float>> result;
+            for (unsigned int i = 0; i < bullets.size(); ++i)
+                result.emplace_back(bullets.x[i], bullets.y[i]);
+
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+
+        for (int f = 0; f < 40; ++f)
+        {
+            a.tick();
+            b.tick();
+            REQUIRE(positions(a.store()) == positions(b.store()));
+        }
+    }
+
+    SECTION("A script error doesn't stall the next tick")
+    {
+        b.setThreadPool(&pool);
+        launch(b, "n = 0 function main(b) n = n + 1 b:setColor(n, 0, 0) end ");
+        b.createBulletFromScript("failed = false "
+                                 "function main(b) "
+                                 "    if b:getTurn() == 2 and not failed then failed = true error('boom') end "
+                                 "end ",
+                                 b.origin.get());
+
+        b.tick();
+        b.tick();
+        REQUIRE_THROWS(b.tick());
+
+        // Every good root keeps running.
+        for (int f = 0; f < 3; ++f)
+        {
+            std::vector<unsigned char> before(b.store().r.begin(), b.store().r.begin() + 6);
+            b.tick();
+
+            for (unsigned int i = 0; i < 6; ++i)
+                REQUIRE(b.store().r[i] > before[i]);
+        }
+
+        b.clear();
+        REQUIRE(b.scriptIds().functionCount() == 0);
+        REQUIRE(b.scriptIds().stateCount() == 0);
+    }
+
+    SECTION("Function users add up once lanes are merged")
+    {
+        // Every frame, each root swaps in a new closure and fires a child running another one.
+        const char* script =
+            "function main(b) "
+            "    b:setFunction(function(b) "
+            "        b:fire(180, 1, function(c) c:setFunction(function() c:kill() end) end) "
+            "    end) "
+            "end ";
+
+        b.setThreadPool(&pool);
+        launch(a, script);
+        launch(b, script);
+
+        for (int f = 0; f < 20; ++f)
+        {
+            a.tick();
+            b.tick();
+
+            REQUIRE(a.bulletCount() == b.bulletCount());
+            REQUIRE(a.scriptIds().functionCount() == b.scriptIds().functionCount());
+            REQUIRE(a.scriptIds().stateCount() == b.scriptIds().stateCount());
+        }
+
+        b.clear();
+        REQUIRE(b.scriptIds().functionCount() == 0);
+        REQUIRE(b.scriptIds().stateCount() == 0);
+    }
+}
+
+TEST_CASE("Simulation Host", "[Parallel]")
+{
+    const char* script =
+        "function child(b) "
+        "    wait(b:randInt(20)) "
+        "    b:aimTarget() "
+        "    wait(1000) "
+        "end "
+        "function main(b) "
+        "    b:fireSpread(3, b:randFloatRange(0, 360), 40, 1.5, child) "
+        "    wait(4) "
+        "end ";
+
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    SimulationHost::Factory create = [](BulletLuaUtils::Rect& p)
+    {
+        return std::unique_ptr<BulletLuaManager>{new BulletTester{p}};
+    };
+
+    // Same instances on one thread and on four.
+    SimulationHost serial{0};
+    SimulationHost host{3};
+
+    REQUIRE(host.preloadScript(script) == true);
+    REQUIRE(host.preloadScript("function main( end") == false);
+
+    for (SimulationHost* h : {&serial, &host})
+    {
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            REQUIRE(h->add(create, player, i) == i);
+
+            BulletTester& manager = static_cast<BulletTester&>(h->manager(i));
+            manager.createBulletFromScript(script, manager.origin.get());
+        }
+
+        // Each instance's player drifts its own way.
+        h->advance(60, [](unsigned int instance, unsigned int frame, BulletLuaManager&,
+                          BulletLuaUtils::Rect& p)
+        {
+            p.setCenter(320.0f + frame * (instance + 1), 240.0f);
+        });
+    }
+
+    auto same = [](SimulationHost& a, unsigned int i, SimulationHost& b, unsigned int j)
+    {
+        const BulletStore& x = static_cast<BulletTester&>(a.manager(i)).store();
+        const BulletStore& y = static_cast<BulletTester&>(b.manager(j)).store();
+
+        if (x.size() != y.size())
+            return false;
+
+        for (unsigned int k = 0; k < x.size(); ++k)
+        {
+            if (x.x[k] != y.x[k] || x.y[k] != y.y[k])
+                return false;
+        }
+
+        return true;
+    };
+
+    REQUIRE(host.frame(0) == 60);
+    REQUIRE(host.totalTicks() == 240);
+    REQUIRE(host.ticksPerSecond() > 0.0);
+    REQUIRE(host.player(1).getCenterX() == Approx(320.0f + 59.0f * 2));
+
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        REQUIRE(same(host, i, serial, i));
+    }
+
+    REQUIRE(host.manager(0).bulletCount() > 1);
+    REQUIRE(same(host, 0, host, 1) == false);
+}
+
+TEST_CASE("Snapshots", "[Snapshot]")
+{
+    SECTION("The reader gets the latest snapshot")
+    {
+        SnapshotBuffer buffer;
+        REQUIRE(buffer.update() == false);
+        REQUIRE(buffer.front().size() == 0);
+
+        for (unsigned int f = 1; f <= 3; ++f)
+        {
+            buffer.back().frame = f;
+            buffer.publish();
+        }
+
+        REQUIRE(buffer.update() == true);
+        REQUIRE(buffer.front().frame == 3);
+        REQUIRE(buffer.update() == false);
+        REQUIRE(&buffer.back() != &buffer.front());
+    }
+
+    SECTION("Manager publishes every tick")
+    {
+        BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+        BulletTester manager{player};
+        manager.setSnapshots(true);
+
+        manager.createBulletFromScript("function main(b) b:setPosition(100, 50) b:setVelocity(0, 2) end",
+                                       manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.snapshots().update() == true);
+
+        const Snapshot& snapshot = manager.snapshots().front();
+        REQUIRE(snapshot.frame == 1);
+        REQUIRE(snapshot.size() == 1);
+        REQUIRE(snapshot.x[0] == manager.store().x[0]);
+        REQUIRE(snapshot.y[0] == manager.store().y[0]);
+        REQUIRE(snapshot.direction[0] == Approx(manager.store().getDirection(0)));
+        REQUIRE(snapshot.handles[0] == manager.store().handles[0]);
+
+        // The snapshot read stays put while later ticks run.
+        manager.tick();
+        REQUIRE(snapshot.frame == 1);
+        REQUIRE(snapshot.y[0] != manager.store().y[0]);
+    }
+
+    SECTION("Reader thread never sees a torn snapshot")
+    {
+        SnapshotBuffer buffer;
+        std::atomic<bool> failed{false};
+        const unsigned int frames = 2000;
+
+        std::thread reader{[&]()
+        {
+            unsigned int last = 0;
+            while (last < frames)
+            {
+                if (!buffer.update())
+                    continue;
+
+                const Snapshot& s = buffer.front();
+                if (s.frame < last || s.size() != s.frame % 64)
+                    failed = true;
+
+                for (float x : s.x)
+                {
+                    if (x != float(s.frame))
+                        failed = true;
+                }
+
+                last = s.frame;
+            }
+        }};
+
+        for (unsigned int f = 1; f <= frames; ++f)
+        {
+            Snapshot& s = buffer.back();
+            s.frame = f;
+            s.x.assign(f % 64, float(f));
+            buffer.publish();
+        }
+
+        reader.join();
+        REQUIRE(failed == false);
+    }
+}
+
+TEST_CASE("Native Behaviors", "[Behavior]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("Turn")
+    {
+        manager.createBulletFromScript("function main(b) b:fire(180, 1, Behavior.turn{rate=90}) b:stop() end ",
+                                       manager.origin.get());
+        manager.tick();
+
+        // Straight down, then a quarter turn clockwise: left.
+        REQUIRE(manager.store().vx[1] == Approx(-1.0f));
+        REQUIRE(manager.store().vy[1] == Approx(0.0f));
+    }
+
+    SECTION("Accelerate and vanish")
+    {
+        manager.createBulletFromScript("function main(b) b:fire(180, 1, Behavior.accelerate{accel=1, maxSpeed=3, life=3}) b:stop() end ",
+                                       manager.origin.get());
+
+        manager.tick();
+        REQUIRE(manager.store().getSpeed(1) == Approx(2.0f));
+
+        manager.tick();
+        manager.tick();
+        REQUIRE(manager.store().getSpeed(1) == Approx(3.0f));
+        REQUIRE_FALSE(manager.store().isDying(1));
+
+        manager.tick();
+        REQUIRE(manager.store().isDying(1));
+    }
+
+    SECTION("Identical behaviors are shared")
+    {
+        const char* script =
+            "function main(b) "
+            "    b:fire(0, 1, Behavior.turn{rate=2}) "
+            "    b:fire(90, 1, Behavior.turn{rate=2}) "
+            "    b:stop() "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.behaviorCount() == 1);
+        REQUIRE(manager.store().behavior[1] == manager.store().behavior[2]);
+        REQUIRE(manager.awakeCount() == 0);
+    }
+
+    SECTION("Behaviors nothing uses are recycled")
+    {
+        // A new behavior every frame, on a child that is gone a few frames later.
+        const char* script =
+            "function main(b) "
+            "    b:fire(0, 1, Behavior.turn{rate=b:getTurn(), life=1}) "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        for (int f = 0; f < 500; ++f)
+            manager.tick();
+
+        REQUIRE(manager.behaviorCount() < 50);
+        REQUIRE(manager.behaviorSlots() < 50);
+
+        manager.clear();
+        REQUIRE(manager.behaviorCount() == 0);
+    }
+
+    SECTION("Homing heads for the target's center")
+    {
+        // The child's center starts straight above the player's center.
+        player.setCenter(320.0f, 242.0f);
+        manager.createBulletFromScript("function main(b) b:fire(180, 1, Behavior.homing{rate=90}) b:stop() end ",
+                                       manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.store().vx[1] == Approx(0.0f));
+        REQUIRE(manager.store().vy[1] > 0.0f);
+    }
+
+    SECTION("Bad lifetimes are rejected")
+    {
+        const char* script =
+            "function main(b) "
+            "    negative = pcall(Behavior.accelerate, {life=-1}) "
+            "    infinite = pcall(Behavior.accelerate, {life=math.huge}) "
+            "    huge = pcall(Behavior.accelerate, {life=1e20}) "
+            "    b:stop() "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+
+        lua_State* L = manager.luaStateOf(0);
+        lua_getglobal(L, "negative");
+        lua_getglobal(L, "infinite");
+        lua_getglobal(L, "huge");
+
+        REQUIRE(lua_toboolean(L, -3) == 0);
+        REQUIRE(lua_toboolean(L, -2) == 0);
+        REQUIRE(lua_toboolean(L, -1) == 1);
+        lua_pop(L, 3);
+    }
+}
+
+TEST_CASE("Pattern Baking", "[Bake]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    const char* script =
+        "function child(b) "
+        "    local t = b:getTurn() "
+        "    if t >= 10 and t < 20 then b:setDirectionRelative(9) end "
+        "    if t == 30 then b:vanish() end "
+        "end "
+        "function main(b) "
+        "    b:fireCircle(8, 2, child) "
+        "    b:kill() "
+        "end ";
+
+    Bullet origin{320.0f, 240.0f, 0.0f, 0.0f};
+    BulletLuaManager::Launcher launch = [&](BulletLuaManager& m)
+    {
+        m.createBulletFromScript(script, &origin);
+    };
+
+    std::shared_ptr<BakedPattern> pattern{new BakedPattern{manager.bake(launch, 80)}};
+
+    SECTION("Recording")
+    {
+        REQUIRE(pattern->frames == 80);
+        REQUIRE(pattern->tracks.size() == 8);
+
+        // Spawn, ten turns, vanishing: far fewer keys than frames.
+        REQUIRE(pattern->keys.size() < 8 * 20);
+        REQUIRE(pattern->tracks[0].end != BakedPattern::FOREVER);
+    }
+
+    SECTION("Replay matches a live run")
+    {
+        REQUIRE(manager.verifyBake(launch, pattern) == -1);
+    }
+
+    SECTION("Replay")
+    {
+        manager.play(pattern);
+        manager.tick();
+
+        REQUIRE(manager.bulletCount() == 8);
+        REQUIRE(manager.awakeCount() == 0);
+
+        for (int i = 0; i < 79; ++i)
+            manager.tick();
+
+        REQUIRE(manager.bulletCount() == 0);
+        REQUIRE(manager.playingCount() == 0);
+    }
+
+    SECTION("Save and load")
+    {
+        const char* filename = "bake_test.blb";
+        REQUIRE(pattern->save(filename));
+
+        std::shared_ptr<BakedPattern> loaded{new BakedPattern};
+        REQUIRE(loaded->load(filename));
+        std::remove(filename);
+
+        REQUIRE(loaded->tracks.size() == pattern->tracks.size());
+        REQUIRE(loaded->keys.size() == pattern->keys.size());
+        REQUIRE(manager.verifyBake(launch, loaded) == -1);
+    }
+}
+
+TEST_CASE("Corrupt Baked Patterns", "[Bake]")
+{
+    const char* filename = "bake_corrupt.blb";
+
+    // One bullet keyframed on frames 0 and 5.
+    BakedPattern pattern;
+    pattern.frames = 10;
+    pattern.tracks.push_back(BakedPattern::Track{0, BakedPattern::FOREVER, 0, 2});
+    pattern.keys.resize(2, BakedPattern::Key{0, 0.0f, 0.0f, 0.0f, 1.0f, 4.0f, 4.0f, 0.0f,
+                                             BulletStore::Collision, 255, ENEMY_BULLETS,
+                                             255, 255, 255});
+    pattern.keys[1].frame = 5;
+
+    BakedPattern loaded;
+
+    SECTION("Valid file")
+    {
+        REQUIRE(pattern.save(filename));
+        REQUIRE(loaded.load(filename));
+        REQUIRE(loaded.keys.size() == 2);
+    }
+
+    SECTION("Counts past the end of the file")
+    {
+        std::ofstream out{filename, std::ios::binary};
+        const unsigned int header[] = {1, 10, 0xFFFFFFFF, 0xFFFFFFFF};
+        out.write("BLBK", 4);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.close();
+
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    SECTION("Key range that wraps around")
+    {
+        pattern.tracks[0].firstKey = 0xFFFFFFFF;
+        REQUIRE(pattern.save(filename));
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    SECTION("Keys out of order")
+    {
+        pattern.keys[1].frame = 0;
+        REQUIRE(pattern.save(filename));
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    SECTION("Spawns out of order")
+    {
+        // A second bullet on frame 0, listed after the one on frame 5.
+        pattern.tracks[0].spawn = 5;
+        pattern.keys[0].frame = 5;
+        pattern.keys[1].frame = 6;
+        pattern.tracks.push_back(BakedPattern::Track{0, BakedPattern::FOREVER, 2, 1});
+        pattern.keys.push_back(pattern.keys[0]);
+        pattern.keys[2].frame = 0;
+        REQUIRE(pattern.save(filename));
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    SECTION("First key off the spawn frame")
+    {
+        pattern.keys[0].frame = 1;
+        REQUIRE(pattern.save(filename));
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    SECTION("Track ending before it starts")
+    {
+        pattern.tracks[0].spawn = 3;
+        pattern.tracks[0].end = 3;
+        pattern.keys[0].frame = 3;
+        REQUIRE(pattern.save(filename));
+        REQUIRE_FALSE(loaded.load(filename));
+    }
+
+    std::remove(filename);
+}
+
+TEST_CASE("State Pool", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("Prewarm")
+    {
+        manager.prewarmStates(4);
+        REQUIRE(manager.idleStateCount() == 4);
+
+        manager.createBulletFromScript("function main(b) end ", manager.origin.get());
+        REQUIRE(manager.idleStateCount() == 3);
+    }
+
+    SECTION("Dead patterns give their state back, without their globals")
+    {
+        manager.createBulletFromScript("leftover = 5 print = nil function main(b) b:kill() end ",
+                                       manager.origin.get());
+        const lua_State* first = manager.luaStateOf(0);
+
+        manager.tick();
+        REQUIRE(manager.bulletCount() == 0);
+        REQUIRE(manager.idleStateCount() == 1);
+
+        const char* script =
+            "function main(b) "
+            "    if leftover == nil and print ~= nil then b:setSpeed(7) end "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(manager.luaStateOf(0) == first);
+        REQUIRE(manager.idleStateCount() == 0);
+
+        manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(7.0f));
+    }
+
+    SECTION("Patched libraries and API are put back")
+    {
+        const char* patch =
+            "math.random = function() return 4 end "
+            "math.extra = 1 "
+            "setmetatable(math, {}) "
+            "getmetatable(_G).__index.setSpeed = nil "
+            "function main(b) b:kill() end ";
+
+        manager.createBulletFromScript(patch, manager.origin.get());
+        manager.tick();
+        REQUIRE(manager.idleStateCount() == 1);
+
+        const char* script =
+            "function main(b) "
+            "    if math.random() < 1 and math.extra == nil and getmetatable(math) == nil then "
+            "        setSpeed(7) "
+            "    end "
+            "end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(7.0f));
+    }
+}
+
+TEST_CASE("Chunk Cache", "[Lua]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    ChunkCache& cache = ChunkCache::instance();
+    cache.clear();
+
+    SECTION("Scripts are compiled once")
+    {
+        const char* script = "function main(b) b:setSpeed(2) end ";
+
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(cache.size() == 1);
+
+        // Both bullets run the cached chunk.
+        manager.tick();
+        REQUIRE(manager.store().getSpeed(0) == Approx(2.0f));
+        REQUIRE(manager.store().getSpeed(1) == Approx(2.0f));
+
+        manager.createBulletFromScript("function main(b) end ", manager.origin.get());
+        REQUIRE(cache.size() == 2);
+    }
+
+    SECTION("Old scripts are dropped past the limit")
+    {
+        cache.setScriptLimit(2);
+        for (int n = 0; n < 5; ++n)
+        {
+            std::string script = "function main(b) b:setSpeed(" + std::to_string(n) + ") end ";
+            manager.createBulletFromScript(script, manager.origin.get());
+        }
+        REQUIRE(cache.size() == 2);
+
+        cache.setScriptLimit(0);
+        REQUIRE(cache.size() == 0);
+
+        cache.setScriptLimit(256);
+    }
+
+    cache.clear();
+}
+
+TEST_CASE("Out of Bounds Check", "[Boundary]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    const char* script =
+        "function main()"
+        "    setPosition(-4, 0)"
+        "end";
+
+    SECTION("Single Bullet")
+    {
+        manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(manager.bulletCount() == 1);
+
+        manager.tick();
+
+        REQUIRE(manager.bulletCount() == 0);
+    }
+}
+
+TEST_CASE("Collision Check", "[Collision]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    const char* script =
+        "function main()"
+        "    setPosition(100, 100)"
+        "end";
+
+    SECTION("Single Bullet")
+    {
+        // Create a bullet, script will move it to (100, 100)
+        manager.createBulletFromScript(script, manager.origin.get());
+        manager.tick();
+
+        // Move our "ship" to (100, 100) as well.
+        player.setCenter(100.0f, 100.0f);
+
+        // std::cout << player.x << " " << player.y << " " << player.w << " " << player.h << std::endl;
+
+        // Is there a collision? There better be.
+        REQUIRE(manager.checkCollision() == true);
+
+        // Offset by one. Since our "ship" is 4 units wide and 4 units tall, this should still be
+        // considered a collision.
+        player.setCenter(99.0f, 99.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        player.setCenter(101.0f, 99.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        player.setCenter(101.0f, 101.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        player.setCenter(99.0f, 101.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        // // No longer a collision.
+        // player.setCenter(102.0f, 102.0f);
+        // REQUIRE(manager.checkCollision() == false);
+    }
+}
+
+TEST_CASE("Collision Across Tiles", "[Collision]")
+{
+    BulletLuaUtils::Rect player{320.0f, 240.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    // Slide a bullet to the right one pixel per tick.
+    const char* script =
+        "function main()"
+        "    setPosition(40 + getTurn(), 100)"
+        "end";
+
+    SECTION("Overlap by one pixel")
+    {
+        manager.createBulletFromScript(script, manager.origin.get());
+
+        // The player trails the bullet by 3px, so they always overlap by 1px and regularly sit
+        // in different tiles.
+        for (int turn = 0; turn < 300; ++turn)
+        {
+            manager.tick();
+
+            player.setCenter(37.0f + turn, 100.0f);
+            REQUIRE(manager.checkCollision() == true);
+        }
+    }
+}
+
+TEST_CASE("Hitbox Shapes", "[Collision]")
+{
+    BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    SECTION("Large box")
+    {
+        manager.createBulletFromScript("function main() setHitbox(40, 10) setPosition(100, 100) end",
+                                       manager.origin.get());
+        manager.tick();
+
+        player.setCenter(118.0f, 100.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        player.setCenter(100.0f, 108.0f);
+        REQUIRE(manager.checkCollision() == false);
+    }
+
+    SECTION("Circle")
+    {
+        manager.createBulletFromScript("function main() setRadius(20) setPosition(100, 100) end",
+                                       manager.origin.get());
+        manager.tick();
+
+        // Inside the circle's bounding box, but outside the circle.
+        player.setCenter(83.0f, 83.0f);
+        REQUIRE(manager.checkCollision() == false);
+
+        player.setCenter(88.0f, 100.0f);
+        REQUIRE(manager.checkCollision() == true);
+
+        REQUIRE(manager.checkCollision(100.0f, 125.0f, 6.0f) == true);
+        REQUIRE(manager.checkCollision(100.0f, 127.0f, 6.0f) == false);
+    }
+}
+
+TEST_CASE("Swept Collision", "[Collision]")
+{
+    // The bullet moves 20px per tick and its 4px box lands at y=238 and y=258, straddling the
+    // player at y=248 without ever touching it at the end of a tick.
+    BulletLuaUtils::Rect player{318.0f, 248.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    const char* script =
+        "function main()"
+        "    setVelocity(0, 20)"
+        "end";
+
+    auto hitWithin = [&](int ticks)
+    {
+        bool hit = false;
+        for (int i = 0; i < ticks; ++i)
+        {
+            manager.tick();
+            hit = hit || manager.checkCollision();
+        }
+        return hit;
+    };
+
+    SECTION("Tunnels without sweeping")
+    {
+        manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(hitWithin(10) == false);
+    }
+
+    SECTION("Swept")
+    {
+        manager.setSweptCollision(true);
+        manager.createBulletFromScript(script, manager.origin.get());
+        REQUIRE(hitWithin(10) == true);
+    }
+}
+
+TEST_CASE("Collision Query", "[Collision]")
+{
+    BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    player.setCenter(100.0f, 100.0f);
+
+    // One bullet on the player, one 6px away, one far away.
+    BulletStore::Handle hit =
+        manager.createBulletFromScript("function main() setPosition(100, 100) end",
+                                       manager.origin.get());
+    manager.createBulletFromScript("function main() setPosition(110, 100) end",
+                                   manager.origin.get());
+    manager.createBulletFromScript("function main() setPosition(200, 100) end",
+                                   manager.origin.get());
+    manager.tick();
+
+    SECTION("Hits and grazes")
+    {
+        BulletStore::Handle hits[4];
+        CollisionResult result = manager.queryCollision(10.0f, hits, 4);
+
+        REQUIRE(result.hits == 1);
+        REQUIRE(hits[0] == hit);
+        REQUIRE(result.grazes == 1);
+        REQUIRE(result.nearest == 0.0f);
+    }
+
+    SECTION("Nearest miss")
+    {
+        player.setCenter(100.0f, 120.0f);
+
+        CollisionResult result = manager.queryCollision(20.0f);
+
+        REQUIRE(result.hits == 0);
+        REQUIRE(result.grazes == 2);
+        REQUIRE(result.nearest == Approx(16.0f));
+    }
+}
+
+TEST_CASE("Collision Layers", "[Collision]")
+{
+    BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletLuaUtils::Rect player2{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletLuaUtils::Rect enemy{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    player.setCenter(300.0f, 300.0f);
+    player2.setCenter(100.0f, 100.0f);
+    enemy.setCenter(200.0f, 100.0f);
+
+    manager.addTarget(player2);
+    manager.addTarget(enemy, PLAYER_BULLETS);
+    REQUIRE(manager.targetCount() == 3);
+
+    bool results[3];
+
+    SECTION("Enemy bullets hit players only")
+    {
+        manager.createBulletFromScript("function main() setPosition(100, 100) end",
+                                       manager.origin.get());
+        manager.createBulletFromScript("function main() setPosition(200, 100) end",
+                                       manager.origin.get());
+        manager.tick();
+        manager.checkCollisions(results);
+
+        REQUIRE(results[0] == false);
+        REQUIRE(results[1] == true);
+        REQUIRE(results[2] == false);
+    }
+
+    SECTION("Player bullets hit enemies only")
+    {
+        manager.createBulletFromScript("function main() setLayer(PLAYER_BULLETS) setPosition(100, 100) end",
+                                       manager.origin.get());
+        manager.createBulletFromScript("function main() setLayer(PLAYER_BULLETS) setPosition(200, 100) end",
+                                       manager.origin.get());
+        manager.tick();
+        manager.checkCollisions(results);
+
+        REQUIRE(results[0] == false);
+        REQUIRE(results[1] == false);
+        REQUIRE(results[2] == true);
+    }
+
+    SECTION("Aim at the nearest target")
+    {
+        // From (100, 0), player2 is straight down and closer than the player.
+        manager.createBulletFromScript("function main() setPosition(100, 0) setVelocity(1, 0) aimNearestTarget() end",
+                                       manager.origin.get());
+        manager.tick();
+
+        REQUIRE(manager.store().vx[0] == Approx(0.0f));
+        REQUIRE(manager.store().vy[0] > 0.0f);
+    }
+}
+
+TEST_CASE("Parallel Grid Build", "[Parallel][Collision]")
+{
+    const BulletLuaUtils::Rect area{0.0f, 0.0f, 640.0f, 480.0f};
+    BulletLuaUtils::MTRandom rng{7};
+
+    // Enough bullets to take the parallel path, some fast enough to be binned along their path.
+    BulletStore bullets;
+    for (unsigned int i = 0; i < 4 * SpacialPartition::PARALLEL_THRESHOLD; ++i)
+    {
+        bullets.add(rng.floatRange(-20.0f, 660.0f), rng.floatRange(-20.0f, 500.0f),
+                    rng.floatRange(-20.0f, 20.0f), 1.0f);
+    }
+
+    ThreadPool pool{3};
+    SpacialPartition serial{bullets, area};
+    SpacialPartition parallel{bullets, area};
+    serial.setSweptCollision(true);
+    parallel.setSweptCollision(true);
+    parallel.setThreadPool(&pool);
+
+    serial.tune(bullets.size());
+    parallel.tune(bullets.size());
+    serial.build();
+    parallel.build();
+
+    REQUIRE(parallel.entryCount() == serial.entryCount());
+
+    // Hits come back in tile order, so they only match if every tile lists the same bullets.
+    BulletStore::Handle serialHits[64];
+    BulletStore::Handle parallelHits[64];
+    for (int i = 0; i < 50; ++i)
+    {
+        BulletLuaUtils::Rect target{rng.floatRange(0.0f, 620.0f), rng.floatRange(0.0f, 460.0f),
+                                    20.0f, 20.0f};
+
+        CollisionResult a = serial.query(target, 10.0f, serialHits, 64);
+        CollisionResult b = parallel.query(target, 10.0f, parallelHits, 64);
+
+        REQUIRE(a.hits == b.hits);
+        REQUIRE(a.grazes == b.grazes);
+        REQUIRE(a.nearest == b.nearest);
+        REQUIRE(std::equal(serialHits, serialHits + std::min(a.hits, 64u), parallelHits));
+    }
+}
+
+TEST_CASE("Grid Tuning", "[Collision]")
+{
+    BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+    BulletTester manager{player};
+
+    // A crowded enemy layer next to an empty player layer.
+    manager.createEmptyBullets(5000);
+    manager.tick();
+    REQUIRE(manager.bulletCount() == 5000);
+
+    // Both grids start with 50px tiles.
+    REQUIRE(manager.tileSize(ENEMY_BULLETS) < 50.0f);
+    REQUIRE(manager.tileSize(PLAYER_BULLETS) > 50.0f);
+}
+
+TEST_CASE("Collision Outside 640x480", "[Collision]")
+{
+    BulletLuaUtils::Rect player{0.0f, 0.0f, 4.0f, 4.0f};
+
+    // Same padded area as the example.
+    BulletLuaManager manager{-100, -100, 840, 680, player};
+    Bullet origin{0.0f, 0.0f, 0.0f, 0.0f};
+
+    SECTION("Negative coordinates")
+    {
+        manager.createBulletFromScript("function main() setPosition(-50, -50) end", &origin);
+        manager.tick();
+
+        player.setCenter(-50.0f, -50.0f);
+        REQUIRE(manager.checkCollision() == true);
+    }
+
+    SECTION("Past 640x480")
+    {
+        manager.createBulletFromScript("function main() setPosition(700, 550) end", &origin);
+        manager.tick();
+
+        player.setCenter(700.0f, 550.0f);
+        REQUIRE(manager.checkCollision() == true);
     }
 }